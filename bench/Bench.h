@@ -0,0 +1,53 @@
+#ifndef PJWEBRTC_BENCH_H
+#define PJWEBRTC_BENCH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/// Minimal timing loop shared by the programs in bench/, built with -DPJWEBRTC_BENCHMARKS=ON.
+/// Replaces the global operator new to count allocations, so it is included from one file per program.
+namespace bench {
+
+  static std::atomic<unsigned long> allocations(0);
+
+  /// Keeps the compiler from dropping a result nobody reads
+  template<typename T> inline void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+
+  /// Mean nanoseconds and heap allocations per call of fun over iterations, after a tenth as many warm-up
+  /// calls. Prints a line too.
+  template<typename F> double measure(const char* name, int iterations, F&& fun) {
+    for(int i = 0; i < iterations / 10 + 1; i++) fun();
+    unsigned long allocationsBefore = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++) fun();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    double nsec = elapsed.count() / iterations;
+    double allocationsPerCall = (double)(allocations.load(std::memory_order_relaxed) - allocationsBefore) / iterations;
+    printf("%-48s %10.1f ns/op %8.2f allocs/op\n", name, nsec, allocationsPerCall);
+    return nsec;
+  }
+
+}
+
+/* Every operator new form without a size-aligned overload ends up here, so this counts them all */
+void* operator new(std::size_t size) {
+  bench::allocations.fetch_add(1, std::memory_order_relaxed);
+  void* pointer = std::malloc(size ? size : 1);
+  if(!pointer) throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+#endif //PJWEBRTC_BENCH_H
@@ -0,0 +1,49 @@
+/// Continuation cost of the promise chains PeerConnection builds: createOffer is Promise<bool> -> then<json> ->
+/// onResolved with a few KB of description inside. Only the public API is used, so the same file builds against
+/// older Promise.h revisions for comparison: promise_bench_baseline is this file against bench/baseline/Promise.h.
+
+#include <cstdlib>
+#include <json.hpp>
+#include "Bench.h"
+#include "Promise.h"
+
+using promise::Promise;
+
+static nlohmann::json makeDescription() {
+  return { {"type", "offer"}, {"sdp", std::string(4000, 'x')} };
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+  unsigned long delivered = 0;
+
+  /// Cost of building the description itself, to subtract from the chain below
+  bench::measure("build 4 KB json", iterations, [&]() {
+    nlohmann::json description = makeDescription();
+    bench::keep(description);
+  });
+
+  bench::measure("bool -> then<json>(resolved) -> onResolved", iterations, [&]() {
+    auto ready = std::make_shared<Promise<bool>>();
+    auto described = ready->then<nlohmann::json>([](bool&) {
+      return Promise<nlohmann::json>::resolved(makeDescription());
+    });
+    described->onResolved([&](nlohmann::json& description) { delivered += description.size(); });
+    ready->resolve(true);
+  });
+
+  bench::measure("int -> then<int> -> onResolved", iterations, [&]() {
+    auto ready = std::make_shared<Promise<int>>();
+    auto next = ready->then<int>([](int& v) { return v + 1; });
+    next->onResolved([&](int& v) { delivered += v; });
+    ready->resolve(1);
+  });
+
+  bench::measure("already resolved, onResolved", iterations, [&]() {
+    auto ready = Promise<int>::resolved(1);
+    ready->onResolved([&](int& v) { delivered += v; });
+  });
+
+  bench::keep(delivered);
+  return 0;
+}
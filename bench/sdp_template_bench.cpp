@@ -0,0 +1,64 @@
+/// Offer/answer skeleton: MediaEngine::createSessionSdp clones a template rendered once per m-line count, the full
+/// path asks the endpoint to render the session and every audio m-line again, as each call did before templates.
+
+#include <cstdlib>
+#include <memory>
+#include "Bench.h"
+#include "../src/EventLoop.h"
+#include "../src/MediaEngine.h"
+#include "../src/global.h"
+
+static pjmedia_sdp_session* createFullSdp(pjmedia_endpt* endpoint, pj_pool_t* pool, int mediaCount) {
+  pj_sockaddr origin;
+  pj_str_t originString = pj_str((char*)"localhost");
+  pj_sockaddr_parse(pj_AF_INET(), 0, &originString, &origin);
+  pjmedia_sdp_session* sdp;
+  pjmedia_endpt_create_base_sdp(endpoint, pool, nullptr, &origin, &sdp);
+
+  pjmedia_sock_info sockInfo;
+  pj_bzero(&sockInfo, sizeof(sockInfo));
+  pj_str_t zeroString = pj_str((char*)"0.0.0.0:9");
+  pj_sockaddr_parse(pj_AF_INET(), 0, &zeroString, &sockInfo.rtp_addr_name);
+  sockInfo.rtcp_addr_name = sockInfo.rtp_addr_name;
+  for(int i = 0; i < mediaCount; i++) {
+    pjmedia_sdp_media* sdpMedia;
+    pjmedia_endpt_create_audio_sdp(endpoint, pool, &sockInfo, 0, &sdpMedia);
+    sdp->media[sdp->media_count++] = sdpMedia;
+  }
+  return sdp;
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  webrtc::init();
+
+  /// Not started, the engine only needs the ioqueue for its endpoint
+  webrtc::EventLoopConfiguration loopConfiguration;
+  auto eventLoop = std::make_shared<webrtc::EventLoop>();
+  eventLoop->init(loopConfiguration);
+  auto mediaEngine = std::make_shared<webrtc::MediaEngine>();
+  mediaEngine->init(eventLoop);
+
+  pj_pool_t* scratch = pj_pool_create(&webrtc::cachingPool.factory, "bench.scratch", 16384, 16384, NULL);
+  const int mediaCounts[] = {1, 2, 4};
+  for(int mediaCount : mediaCounts) {
+    char name[64];
+    snprintf(name, sizeof(name), "full render, %d m-lines", mediaCount);
+    double full = bench::measure(name, iterations, [&]() {
+      pj_pool_reset(scratch);
+      bench::keep(createFullSdp(mediaEngine->mediaEndpoint, scratch, mediaCount));
+    });
+    snprintf(name, sizeof(name), "template clone, %d m-lines", mediaCount);
+    double cloned = bench::measure(name, iterations, [&]() {
+      pj_pool_reset(scratch);
+      bench::keep(mediaEngine->createSessionSdp(scratch, mediaCount));
+    });
+    printf("speedup %.2fx\n", full / cloned);
+  }
+
+  pj_pool_release(scratch);
+  mediaEngine.reset();
+  eventLoop.reset();
+  webrtc::destroy();
+  return 0;
+}
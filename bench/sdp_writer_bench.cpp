@@ -0,0 +1,110 @@
+/// Local description rendering, up to the json handed to the application: SdpWriter edits the session and prints
+/// once into a reused buffer, the text path it replaced printed into a stack buffer and filtered the lines through
+/// string streams. Allocations per offer are counted by Bench.h.
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <json.hpp>
+#include "Bench.h"
+#include "../src/SdpWriter.h"
+#include "../src/global.h"
+
+static const char* SAMPLE_SDP =
+    "v=0\r\n"
+    "o=- 3724394400 3724394400 IN IP4 127.0.0.1\r\n"
+    "s=pjmedia\r\n"
+    "t=0 0\r\n"
+    "a=group:BUNDLE audio audio1\r\n"
+    "m=audio 9 UDP/TLS/RTP/SAVPF 9 0 8 101\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "a=rtcp:9 IN IP4 0.0.0.0\r\n"
+    "a=ice-ufrag:Ht6kSgaE\r\n"
+    "a=ice-pwd:qpL1ZcyXlRWZbCW2fxNH1xTf\r\n"
+    "a=candidate:Hc0a80102 1 UDP 2130706431 192.168.1.2 40000 typ host\r\n"
+    "a=candidate:Sc0a80102 1 UDP 1694498815 203.0.113.7 40000 typ srflx raddr 192.168.1.2 rport 40000\r\n"
+    "a=candidate:Rc0a80102 1 UDP 16777215 198.51.100.9 50000 typ relay raddr 203.0.113.7 rport 40000\r\n"
+    "a=fingerprint:sha-256 4A:AD:B9:B1:3F:82:18:3B:54:02:12:DF:3E:5D:49:6B:19:E5:7C:AB:4A:AD:B9:B1:3F:82:18:3B:54:02:"
+    "12:DF\r\n"
+    "a=setup:actpass\r\n"
+    "a=rtcp-mux\r\n"
+    "a=rtpmap:9 G722/8000\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n"
+    "a=rtpmap:8 PCMA/8000\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n"
+    "a=fmtp:101 0-16\r\n"
+    "a=sendrecv\r\n"
+    "a=mid:audio\r\n"
+    "m=audio 9 UDP/TLS/RTP/SAVPF 9 0 8 101\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "a=rtcp:9 IN IP4 0.0.0.0\r\n"
+    "a=ice-ufrag:Ht6kSgaE\r\n"
+    "a=ice-pwd:qpL1ZcyXlRWZbCW2fxNH1xTf\r\n"
+    "a=fingerprint:sha-256 4A:AD:B9:B1:3F:82:18:3B:54:02:12:DF:3E:5D:49:6B:19:E5:7C:AB:4A:AD:B9:B1:3F:82:18:3B:54:02:"
+    "12:DF\r\n"
+    "a=setup:actpass\r\n"
+    "a=rtcp-mux\r\n"
+    "a=rtpmap:9 G722/8000\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n"
+    "a=rtpmap:8 PCMA/8000\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n"
+    "a=fmtp:101 0-16\r\n"
+    "a=sendrecv\r\n"
+    "a=mid:audio1\r\n";
+
+/// What doCreateOffer did before SdpWriter, minus the per-line logging
+static std::string writeText(const pjmedia_sdp_session* sdp, std::string& ufrag) {
+  char buf[10240];
+  int size = pjmedia_sdp_print(sdp, buf, sizeof(buf));
+  std::string rawSdpString(buf, size);
+  bool hasIceOptions = rawSdpString.find("a=ice-options:") != std::string::npos;
+  std::istringstream iss(rawSdpString);
+  std::ostringstream oss;
+  std::string line;
+  while(std::getline(iss, line, '\n')) {
+    if(line.substr(0, 12) == "a=candidate:") continue;
+    oss << line << '\n';
+    if(line.substr(0, 12) == "a=ice-ufrag:") ufrag = line.substr(12, line.size() - 12 - 1);
+    if(line.substr(0, 10) == "a=ice-pwd:" && !hasIceOptions) oss << "a=ice-options:trickle\r\n";
+  }
+  return oss.str();
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  webrtc::init();
+  pj_pool_t* pool = pj_pool_create(&webrtc::cachingPool.factory, "bench", 16384, 16384, NULL);
+  pj_pool_t* scratch = pj_pool_create(&webrtc::cachingPool.factory, "bench.scratch", 16384, 16384, NULL);
+
+  std::string text = SAMPLE_SDP;
+  pjmedia_sdp_session* sdp;
+  pj_status_t status = pjmedia_sdp_parse(pool, &text[0], text.size(), &sdp);
+  if(status != PJ_SUCCESS) {
+    printf("SAMPLE SDP DOES NOT PARSE %d\n", status);
+    return 1;
+  }
+
+  /// Both paths start from a fresh clone, prepare() edits the session it is given
+  webrtc::SdpWriter writer;
+  double before = bench::measure("text filter (before)", iterations, [&]() {
+    pj_pool_reset(scratch);
+    pjmedia_sdp_session* session = pjmedia_sdp_session_clone(scratch, sdp);
+    std::string ufrag;
+    std::string result = writeText(session, ufrag);
+    nlohmann::json offer = { {"type", "offer"}, {"sdp", std::move(result)} };
+    bench::keep(offer);
+  });
+  double after = bench::measure("SdpWriter prepare + write", iterations, [&]() {
+    pj_pool_reset(scratch);
+    pjmedia_sdp_session* session = pjmedia_sdp_session_clone(scratch, sdp);
+    writer.prepare(scratch, session);
+    nlohmann::json offer = { {"type", "offer"}, {"sdp", writer.write(session)} };
+    bench::keep(offer);
+  });
+  printf("speedup %.2fx\n", before / after);
+
+  pj_pool_release(scratch);
+  pj_pool_release(pool);
+  webrtc::destroy();
+  return 0;
+}
@@ -0,0 +1,93 @@
+/// UdpMux syscall batching on loopback: receive throughput of the reader thread with recvfrom (batchSize 1),
+/// recvmmsg and, when built in, io_uring, then sendto per packet against sendBatch over sendmmsg.
+
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "../src/UdpMux.h"
+#include "../src/global.h"
+
+static const int PACKET_SIZE = 172; /* 20 ms of G.711 with RTP and SRTP overhead */
+static const int BURST = 64;
+
+static pj_sock_t openSocket(pj_sockaddr* address) {
+  pj_sock_t sock;
+  pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0, &sock);
+  pj_str_t loopback = pj_str((char*)"127.0.0.1");
+  pj_sockaddr_init(pj_AF_INET(), address, &loopback, 0);
+  pj_sock_bind(sock, address, pj_sockaddr_get_len(address));
+  int addressLength = sizeof(pj_sockaddr);
+  pj_sock_getsockname(sock, address, &addressLength);
+  return sock;
+}
+
+/// Nanoseconds per datagram from the first send until the mux has read them all, bursts wait for the reader
+/// so the socket buffer never overflows. Packets belong to no connection, the mux reads and drops them.
+static void benchReceive(const char* name, int packets, int batchSize, bool ioUring) {
+  webrtc::UdpMuxConfiguration configuration;
+  configuration.bindAddress = "127.0.0.1";
+  configuration.batchSize = batchSize;
+  configuration.ioUring = ioUring;
+  webrtc::UdpMux mux;
+  mux.init(configuration);
+
+  pj_sockaddr senderAddress;
+  pj_sock_t sender = openSocket(&senderAddress);
+  std::string packet(PACKET_SIZE, '\x80');
+  unsigned long received = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for(int sent = 0; sent < packets; ) {
+    for(int i = 0; i < BURST && sent < packets; i++, sent++) {
+      pj_ssize_t size = packet.size();
+      pj_sock_sendto(sender, packet.data(), &size, 0, &mux.publicAddress, pj_sockaddr_get_len(&mux.publicAddress));
+    }
+    auto burstStart = std::chrono::steady_clock::now();
+    while((received = mux.packetsReceived.load()) < (unsigned long)sent
+          && std::chrono::steady_clock::now() - burstStart < std::chrono::milliseconds(100)) {
+      std::this_thread::yield();
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  unsigned long calls = mux.receiveCalls.load();
+  printf("%-48s %10.1f ns/packet  %5.1f packets/call  %lu lost\n", name, elapsed.count() / packets,
+         calls ? (double)received / calls : 0.0, packets - received);
+
+  mux.stop();
+  pj_sock_close(sender);
+}
+
+int main(int argc, char** argv) {
+  int packets = argc > 1 ? atoi(argv[1]) : 200000;
+  webrtc::init();
+
+  benchReceive("receive, recvfrom", packets, 1, false);
+  benchReceive("receive, recvmmsg x32", packets, 32, false);
+#if PJWEBRTC_HAS_IO_URING
+  benchReceive("receive, io_uring multishot", packets, 32, true);
+#endif
+
+  /// Sends go to a socket nobody reads, the kernel drops what doesn't fit in its buffer
+  webrtc::UdpMuxConfiguration configuration;
+  configuration.bindAddress = "127.0.0.1";
+  configuration.ioUring = false;
+  webrtc::UdpMux mux;
+  mux.init(configuration);
+  pj_sockaddr sinkAddress;
+  pj_sock_t sink = openSocket(&sinkAddress);
+  std::vector<std::string> burst(32, std::string(PACKET_SIZE, '\x80'));
+
+  bench::measure("send, sendto per packet (x32)", packets / 32, [&]() {
+    for(auto& packet : burst) mux.send(0, &sinkAddress, packet.data(), packet.size());
+  });
+  bench::measure("send, sendBatch over sendmmsg (x32)", packets / 32, [&]() {
+    mux.sendBatch(0, &sinkAddress, burst);
+  });
+
+  mux.stop();
+  pj_sock_close(sink);
+  webrtc::destroy();
+  return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef PROMISE_COROUTINE_H
+#define PROMISE_COROUTINE_H
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define PROMISE_HAS_COROUTINES 1
+#else
+#define PROMISE_HAS_COROUTINES 0
+#endif
+
+#if PROMISE_HAS_COROUTINES
+
+#include <coroutine>
+#include "Promise.h"
+
+namespace promise {
+
+  /// co_await on a promise: resumes where the promise settles (or on its executor), throws the rejection,
+  /// an Error as PromiseError
+  template<typename T> struct PromiseAwaiter {
+    std::shared_ptr<Promise<T>> promise;
+
+    bool await_ready() const noexcept {
+      return promise->state != Promise<T>::PromiseState::Pending;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      promise->when([handle](Promise<T>&) { handle.resume(); }, true);
+    }
+
+    T await_resume() {
+      if(promise->state == Promise<T>::PromiseState::Rejected) std::rethrow_exception(promise->rejectionException());
+      if(promise.use_count() == 1) return std::move(promise->result);
+      return promise->result;
+    }
+  };
+
+  /// Found by ADL through the template argument, so any std::shared_ptr<Promise<T>> can be awaited
+  template<typename T> PromiseAwaiter<T> operator co_await(std::shared_ptr<Promise<T>> promise) {
+    return PromiseAwaiter<T>{std::move(promise)};
+  }
+
+  /// Coroutine state behind a function returning std::shared_ptr<Promise<T>>, co_return resolves it
+  template<typename T> struct CoroutinePromise {
+    std::shared_ptr<Promise<T>> promise = std::make_shared<Promise<T>>();
+
+    std::shared_ptr<Promise<T>> get_return_object() {
+      return promise;
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+
+    void return_value(const T& value) {
+      promise->resolve(value);
+    }
+    void return_value(T&& value) {
+      promise->resolve(std::move(value));
+    }
+    /// co_return Error(...) rejects without throwing
+    void return_value(Error error) {
+      promise->reject(error);
+    }
+
+    /// PromiseError goes back to the Error channel, anything else is rethrown to whoever resumed us when
+    /// nobody handles it
+    void unhandled_exception() {
+      try {
+        throw;
+      } catch(PromiseError& promiseError) {
+        promise->reject(promiseError.error);
+      } catch(...) {
+        promise->reject(std::current_exception());
+      }
+    }
+  };
+
+}
+
+template<typename T, typename... Args> struct std::coroutine_traits<std::shared_ptr<promise::Promise<T>>, Args...> {
+  using promise_type = promise::CoroutinePromise<T>;
+};
+
+#endif
+
+#endif //PROMISE_COROUTINE_H
@@ -0,0 +1,26 @@
+#ifndef PROMISE_EXECUTOR_H
+#define PROMISE_EXECUTOR_H
+
+#include "SmallFunction.h"
+
+namespace promise {
+
+  using Task = SmallFunction<void()>;
+
+  /// Something that runs tasks on its own threads, an event loop usually. Continuations attached after
+  /// Promise::on(executor) run there instead of on the thread that settled the promise.
+  class Executor {
+  public:
+    virtual ~Executor() {}
+
+    /// Thread-safe, task runs later, never inside this call
+    virtual void execute(Task task) = 0;
+    /// Runs task once msec passed, returns an id for clearTimeout
+    virtual unsigned long setTimeout(Task task, int msec) = 0;
+    /// False when the task already ran or is running
+    virtual bool clearTimeout(unsigned long timeoutId) = 0;
+  };
+
+}
+
+#endif //PROMISE_EXECUTOR_H
@@ -5,14 +5,45 @@
 #ifndef PROMISE_H
 #define PROMISE_H
 
+#include <atomic>
 #include <functional>
 #include <exception>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include "Executor.h"
+#include "SmallFunction.h"
 
 namespace promise {
 
+  /// What calling F with arguments of types A gives
+  template<typename F, typename... A> using ResultOf = decltype(std::declval<F&>()(std::declval<A>()...));
+
+  /// Rejection reason passed along without throwing, message is a static string
+  struct Error {
+    /// Codes of the promise library itself, positive ones belong to the caller, pj_status_t mostly
+    enum : int { Exception = -1, Timeout = -2 };
+
+    int code;
+    const char* message;
+
+    Error() : code(0), message("") {}
+    Error(int codep, const char* messagep) : code(codep), message(messagep) {}
+  };
+
+  /// Exception adapter, what exception-style handlers see when a promise was rejected with an Error
+  class PromiseError : public std::runtime_error {
+  public:
+    Error error;
+
+    PromiseError(Error errorp) : std::runtime_error(errorp.message), error(errorp) {}
+  };
+
+  /// Settles once; resolve, reject and adding continuations are safe from any thread.
   template<typename T> class Promise : public std::enable_shared_from_this<Promise<T>> {
   public:
     enum class PromiseState {
@@ -23,16 +54,112 @@ namespace promise {
 
     using ResolveCallback = std::function<void(T& result)>;
     using RejectCallback = std::function<void(std::exception_ptr exception)>;
+    using FailCallback = std::function<void(const Error& error)>;
+    /// Runs once when the promise settles, looks at state itself
+    using Continuation = SmallFunction<void(Promise<T>& promise)>;
 
-    PromiseState state;
+    std::atomic<PromiseState> state;
 
+    /* Written once before state leaves Pending, read-only afterwards. A rejection has either error or exception */
     T result;
+    Error error;
     std::exception_ptr exception;
 
-    std::vector<ResolveCallback> resolveCallbacks;
-    std::vector<RejectCallback> rejectCallbacks;
+  private:
+    template<typename> friend class Promise;
+    template<typename> friend struct PromiseAwaiter;
+
+    std::mutex mutex;
+    std::shared_ptr<Executor> executor; /* Set by on(), inherited by promises created from this one */
+    Continuation firstContinuation; // nearly every promise has exactly one follower, it takes no allocation
+    std::vector<Continuation> continuations;
+    int rejectHandlersCount;
+
+    void when(Continuation&& continuation, bool handlesRejection) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(state == PromiseState::Pending) {
+          if(handlesRejection) rejectHandlersCount++;
+          if(!firstContinuation) firstContinuation = std::move(continuation);
+          else continuations.push_back(std::move(continuation));
+          return;
+        }
+      }
+      if(executor) {
+        /// Settled already, but the continuation still belongs on the executor
+        auto self = this->shared_from_this();
+        executor->execute([self, continuation = std::move(continuation)]() mutable { continuation(*self); });
+        return;
+      }
+      continuation(*this);
+    }
+
+    /// Passes a rejection on through the same channel it came from
+    template<typename U> void rejectLike(const Promise<U>& from) {
+      if(from.exception) reject(from.exception);
+      else reject(from.error);
+    }
 
-    Promise() : state(PromiseState::Pending) {
+    /* A continuation returning a promise is followed, one returning a value resolves res with it */
+    template<typename F, typename A> static void settleWith(const std::shared_ptr<Promise<T>>& res, F& fun,
+                                                            A& argument) {
+      settleWith(res, fun, argument, std::is_same<typename std::decay<ResultOf<F, A&>>::type,
+                                                  std::shared_ptr<Promise<T>>>());
+    }
+    template<typename F, typename A> static void settleWith(const std::shared_ptr<Promise<T>>& res, F& fun,
+                                                            A& argument, std::true_type) {
+      forward(fun(argument), res);
+    }
+    template<typename F, typename A> static void settleWith(const std::shared_ptr<Promise<T>>& res, F& fun,
+                                                            A& argument, std::false_type) {
+      try {
+        res->resolve(fun(argument));
+      } catch(...) {
+        res->reject(std::current_exception());
+      }
+    }
+
+    template<typename R, typename F> static void resolveWith(const std::shared_ptr<Promise<R>>& res, F& fun,
+                                                             Promise<T>& from, std::true_type) {
+      fun(from.result);
+      res->resolve(from.result);
+    }
+    template<typename R, typename F> static void resolveWith(const std::shared_ptr<Promise<R>>& res, F& fun,
+                                                             Promise<T>& from, std::false_type) {
+      Promise<R>::settleWith(res, fun, from.result);
+    }
+    template<typename R, typename E> static void rejectWith(const std::shared_ptr<Promise<R>>& res, E& err,
+                                                            Promise<T>& from, std::true_type) {
+      err(from.rejectionException());
+      res->rejectLike(from);
+    }
+    template<typename R, typename E> static void rejectWith(const std::shared_ptr<Promise<R>>& res, E& err,
+                                                            Promise<T>& from, std::false_type) {
+      Promise<R>::forward(err(from.rejectionException()), res);
+    }
+
+    template<typename R> std::shared_ptr<Promise<R>> follower() {
+      auto res = std::make_shared<Promise<R>>();
+      res->executor = executor;
+      return res;
+    }
+
+    /// Publishes the outcome and runs continuations outside the lock, true when someone handles rejection
+    bool settle(PromiseState outcome, std::unique_lock<std::mutex>& lock) {
+      state = outcome;
+      Continuation first = std::move(firstContinuation);
+      std::vector<Continuation> rest;
+      rest.swap(continuations);
+      bool handled = rejectHandlersCount > 0;
+      rejectHandlersCount = 0;
+      lock.unlock();
+      if(first) first(*this);
+      for(auto& continuation : rest) continuation(*this);
+      return handled;
+    }
+
+  public:
+    Promise() : state(PromiseState::Pending), rejectHandlersCount(0) {
     }
     ~Promise() {}
 
@@ -44,134 +171,198 @@ namespace promise {
       }
     }
 
-    void resolve(T resultp) {
-      state = PromiseState::Resolved;
+    /// First outcome wins, later resolve or reject calls are ignored
+    void resolve(const T& resultp) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(state != PromiseState::Pending) return;
       result = resultp;
-      for(auto& cb : resolveCallbacks) {
-        cb(result);
-      }
-      resolveCallbacks.clear();
-      rejectCallbacks.clear();
+      settle(PromiseState::Resolved, lock);
+    }
+    void resolve(T&& resultp) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(state != PromiseState::Pending) return;
+      result = std::move(resultp);
+      settle(PromiseState::Resolved, lock);
     }
+    /// Rethrows when nobody handles the rejection
     void reject(std::exception_ptr exceptionp) {
-      if(state == PromiseState::Rejected) return; // already rejected
-      state = PromiseState::Rejected;
+      std::unique_lock<std::mutex> lock(mutex);
+      if(state != PromiseState::Pending) return; // already settled
       exception = exceptionp;
-      for(auto& cb : rejectCallbacks) {
-        cb(exception);
-      }
-      resolveCallbacks.clear();
-      if(rejectCallbacks.size() == 0) {
-        rejectCallbacks.clear();
-        std::rethrow_exception(exceptionp);
+      if(!settle(PromiseState::Rejected, lock)) std::rethrow_exception(exceptionp);
+    }
+    /// Never throws, an error nobody handles is dropped
+    void reject(Error errorp) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(state != PromiseState::Pending) return;
+      error = errorp;
+      settle(PromiseState::Rejected, lock);
+    }
+
+    /// Rejection as an exception, built only for handlers that ask for one
+    std::exception_ptr rejectionException() const {
+      if(exception) return exception;
+      return std::make_exception_ptr(PromiseError(error));
+    }
+    /// Rejection as an Error, exceptions other than PromiseError become Error::Exception
+    Error rejectionError() const {
+      if(!exception) return error;
+      try {
+        std::rethrow_exception(exception);
+      } catch(PromiseError& promiseError) {
+        return promiseError.error;
+      } catch(...) {
+        return Error(Error::Exception, "exception");
       }
-      rejectCallbacks.clear();
     }
 
     void chain(std::shared_ptr<Promise<T>> to) {
-      onRejected([to](std::exception_ptr ex){
-        to->reject(ex);
-      });
-      onResolved([to](T res){
-        to->resolve(res);
-      });
-    }
-
-    void onResolved(ResolveCallback callback) {
-      if(state == PromiseState::Pending) {
-        resolveCallbacks.push_back(callback);
-      } else if(state == PromiseState::Resolved) {
-        callback(result);
-      }
+      when([to](Promise<T>& from) {
+        if(from.state == PromiseState::Resolved) to->resolve(from.result);
+        else to->rejectLike(from);
+      }, true);
     }
-    void onRejected(RejectCallback callback) {
-      if(state == PromiseState::Pending) {
-        rejectCallbacks.push_back(callback);
-      } else if(state == PromiseState::Rejected) {
-        callback(exception);
+
+    /// Settles `to` the same way, a resolved promise nobody else holds moves its result instead of copying
+    static void forward(std::shared_ptr<Promise<T>>&& from, std::shared_ptr<Promise<T>> to) {
+      if(from->state == PromiseState::Resolved && from.use_count() == 1) {
+        to->resolve(std::move(from->result));
+      } else {
+        from->chain(std::move(to));
       }
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> then(std::function<std::shared_ptr<Promise<R>>(T& result)> fun) {
-      auto res = std::make_shared<Promise<R>>();
-      onResolved([res, fun](T& result){
-        fun(result)->chain(res);
-      });
-      onRejected([res](std::exception_ptr exceptionp) {
-        res->reject(exceptionp);
-      });
+    /// Same outcome, but everything attached to the returned promise runs on executor
+    std::shared_ptr<Promise<T>> on(std::shared_ptr<Executor> executorp) {
+      auto res = std::make_shared<Promise<T>>();
+      res->executor = executorp;
+      /* Only res is captured, this holds the continuation, capturing this too would keep a pending one forever */
+      when([res, executorp](Promise<T>& from) {
+        auto settled = from.shared_from_this();
+        executorp->execute([res, settled]() {
+          if(settled->state == PromiseState::Resolved) res->resolve(settled->result);
+          else res->rejectLike(*settled);
+        });
+      }, true);
       return res;
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> then(std::function<R(T& result)> fun) {
-      auto res = std::make_shared<Promise<R>>();
-      onResolved([res, fun](T& result){
-        try {
-          res->resolve(fun(result));
-        } catch(...) {
-          res->reject(std::current_exception());
-        }
-      });
-      onRejected([res](std::exception_ptr exceptionp) {
-        res->reject(exceptionp);
-      });
+    /// Same outcome, or Error::Timeout when this is still pending after msec. The timer holds the returned
+    /// promise weakly, this holds it strongly through its continuation, so it times out while this is pending
+    /// and the timer keeps nothing alive once this settled.
+    std::shared_ptr<Promise<T>> withTimeout(std::shared_ptr<Executor> executorp, int msec) {
+      auto res = follower<T>();
+      std::weak_ptr<Promise<T>> weakRes = res;
+      unsigned long timeoutId = executorp->setTimeout([weakRes]() {
+        auto res = weakRes.lock();
+        if(res) res->reject(Error(Error::Timeout, "promise timed out"));
+      }, msec);
+      when([res, executorp, timeoutId](Promise<T>& from) {
+        executorp->clearTimeout(timeoutId);
+        if(from.state == PromiseState::Resolved) res->resolve(from.result);
+        else res->rejectLike(from);
+      }, true);
       return res;
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> then(std::function<std::shared_ptr<Promise<R>>(T& result)> fun,
-                                                          std::function<std::shared_ptr<Promise<R>>(std::exception_ptr exception)> err) {
-      auto res = std::make_shared<Promise<R>>();
-      onResolved([res, fun](T& result){
-        fun(result)->chain(res);
-      });
-      onRejected([res, err](std::exception_ptr exceptionp) {
-        err(exceptionp)->chain(res);
-      });
+    /// Callbacks of the ResolveCallback, RejectCallback and FailCallback shapes, any callable
+    template<typename F> void onResolved(F callback) {
+      when([callback](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Resolved) callback(from.result);
+      }, false);
+    }
+    template<typename F> void onRejected(F callback) {
+      when([callback](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Rejected) callback(from.rejectionException());
+      }, true);
+    }
+    template<typename F> void onFailed(F callback) {
+      when([callback](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Rejected) callback(from.rejectionError());
+      }, true);
+    }
+
+    /// fun returns R, or a promise of R the result follows. Callables are stored as they are, a continuation
+    /// holding res and a small lambda stays inside its SmallFunction.
+    template<typename R, typename F> std::shared_ptr<Promise<R>> then(F fun) {
+      auto res = follower<R>();
+      when([res, fun](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Resolved) Promise<R>::settleWith(res, fun, from.result);
+        else res->rejectLike(from);
+      }, true);
       return res;
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> then(std::function<std::shared_ptr<Promise<R>>(T result)> fun,
-                                                          std::function<void(std::exception_ptr exception)> err) {
-      auto res = std::make_shared<Promise<R>>();
-      onResolved([res, fun](T& result){
-        fun(result)->chain(res);
-      });
-      onRejected(err);
-      onRejected([res](std::exception_ptr exceptionp) {
-        res->reject(exceptionp);
-      });
+    /// fun as above or void, which passes the result on. err returns a promise of R or void, which passes
+    /// the rejection on.
+    template<typename R, typename F, typename E> std::shared_ptr<Promise<R>> then(F fun, E err) {
+      auto res = follower<R>();
+      when([res, fun, err](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Resolved) resolveWith(res, fun, from, std::is_void<ResultOf<F, T&>>());
+        else rejectWith(res, err, from, std::is_void<ResultOf<E, std::exception_ptr>>());
+      }, true);
       return res;
     }
-    template<typename R> std::shared_ptr<Promise<R>> then(std::function<void(T& result)> fun,
-                                                           std::function<void(std::exception_ptr exception)> err) {
-      auto res = std::make_shared<Promise<R>>();
-      onResolved(fun);
-      onRejected(err);
-      chain(res);
+
+    template<typename R, typename E> std::shared_ptr<Promise<R>> grab(E err) {
+      auto res = follower<R>();
+      when([res, err](Promise<T>& from) mutable {
+        if(from.state == PromiseState::Resolved) res->resolve(from.result);
+        else rejectWith(res, err, from, std::is_void<ResultOf<E, std::exception_ptr>>());
+      }, true);
       return res;
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> grab(std::function<void(std::exception_ptr exception)> err) {
-      auto res = std::make_shared<Promise<R>>();
-      onRejected(err);
-      chain(res);
+    /// Results in input order once every promise resolved, rejected with the first rejection. Like then, the
+    /// result runs its continuations on the executor of the first promise.
+    static std::shared_ptr<Promise<std::vector<T>>> all(const std::vector<std::shared_ptr<Promise<T>>>& promises) {
+      struct AllState {
+        std::mutex mutex;
+        std::vector<T> results;
+        std::size_t remaining;
+      };
+      if(promises.empty()) {
+        auto res = std::make_shared<Promise<std::vector<T>>>();
+        res->resolve(std::vector<T>());
+        return res;
+      }
+      auto res = promises[0]->template follower<std::vector<T>>();
+      auto allState = std::make_shared<AllState>();
+      allState->results.resize(promises.size());
+      allState->remaining = promises.size();
+      for(std::size_t i = 0; i < promises.size(); i++) {
+        promises[i]->when([res, allState, i](Promise<T>& from) {
+          if(from.state == PromiseState::Rejected) {
+            res->rejectLike(from);
+            return;
+          }
+          bool done;
+          {
+            std::lock_guard<std::mutex> lock(allState->mutex);
+            allState->results[i] = from.result;
+            done = --allState->remaining == 0;
+          }
+          if(done) res->resolve(std::move(allState->results));
+        }, true);
+      }
       return res;
     }
 
-    template<typename R> std::shared_ptr<Promise<R>> grab(std::function<std::shared_ptr<Promise<R>> (std::exception_ptr exception)> err) {
-      auto res = std::make_shared<Promise<R>>();
-      onRejected([res, err](std::exception_ptr exceptionp){
-        err(exceptionp)->chain(res);
-      });
-      onResolved([res](T& result) {
-        res->resolve(result);
-      });
+    /// Settles like whichever promise settles first, on the executor of the first one like then
+    static std::shared_ptr<Promise<T>> race(const std::vector<std::shared_ptr<Promise<T>>>& promises) {
+      auto res = promises.empty() ? std::make_shared<Promise<T>>() : promises[0]->template follower<T>();
+      for(auto& promise : promises) {
+        promise->when([res](Promise<T>& from) {
+          if(from.state == PromiseState::Resolved) res->resolve(from.result);
+          else res->rejectLike(from);
+        }, true);
+      }
       return res;
     }
 
     static std::shared_ptr<Promise<T>> resolved(T result) {
       auto p = std::make_shared<Promise<T>>();
-      p->resolve(result);
+      p->resolve(std::move(result));
       return p;
     }
     static std::shared_ptr<Promise<T>> rejected(std::exception_ptr exceptionp) {
@@ -179,9 +370,13 @@ namespace promise {
       p->reject(exceptionp);
       return p;
     }
+    static std::shared_ptr<Promise<T>> rejected(Error errorp) {
+      auto p = std::make_shared<Promise<T>>();
+      p->reject(errorp);
+      return p;
+    }
   };
 
 }
 
 #endif //TANKS_PROMISE_H
-
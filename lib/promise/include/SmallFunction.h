@@ -0,0 +1,118 @@
+#ifndef PROMISE_SMALLFUNCTION_H
+#define PROMISE_SMALLFUNCTION_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace promise {
+
+  template<typename Signature, std::size_t Capacity = 64> class SmallFunction;
+
+  /// Move-only std::function replacement, callables up to Capacity bytes live inside the object, no heap.
+  template<typename R, typename... Args, std::size_t Capacity> class SmallFunction<R(Args...), Capacity> {
+  private:
+    enum class Operation { Move, Destroy };
+
+    using Invoke = R (*)(void* storage, Args... args);
+    using Manage = void (*)(Operation operation, void* storage, void* target);
+
+    typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage;
+    Invoke invoke;
+    Manage manage;
+
+    template<typename F> struct Inline {
+      static R call(void* storage, Args... args) {
+        return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+      }
+      static void handle(Operation operation, void* storage, void* target) {
+        F* callable = static_cast<F*>(storage);
+        if(operation == Operation::Move) new (target) F(std::move(*callable));
+        callable->~F();
+      }
+    };
+
+    template<typename F> struct Heap {
+      static R call(void* storage, Args... args) {
+        return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+      }
+      static void handle(Operation operation, void* storage, void* target) {
+        F** callable = static_cast<F**>(storage);
+        if(operation == Operation::Move) *static_cast<F**>(target) = *callable;
+        else delete *callable;
+      }
+    };
+
+    template<typename F> using fitsInline = std::integral_constant<bool,
+        sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible<F>::value>;
+
+    template<typename F> void store(F&& callable, std::true_type) {
+      using Callable = typename std::decay<F>::type;
+      new (&storage) Callable(std::forward<F>(callable));
+      invoke = &Inline<Callable>::call;
+      manage = &Inline<Callable>::handle;
+    }
+
+    template<typename F> void store(F&& callable, std::false_type) {
+      using Callable = typename std::decay<F>::type;
+      *reinterpret_cast<Callable**>(&storage) = new Callable(std::forward<F>(callable));
+      invoke = &Heap<Callable>::call;
+      manage = &Heap<Callable>::handle;
+    }
+
+    void moveFrom(SmallFunction& other) noexcept {
+      invoke = other.invoke;
+      manage = other.manage;
+      if(manage) other.manage(Operation::Move, &other.storage, &storage);
+      other.invoke = nullptr;
+      other.manage = nullptr;
+    }
+
+  public:
+    SmallFunction() noexcept : invoke(nullptr), manage(nullptr) {
+    }
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, SmallFunction>::value>::type>
+    SmallFunction(F&& callable) : invoke(nullptr), manage(nullptr) {
+      store(std::forward<F>(callable), fitsInline<typename std::decay<F>::type>());
+    }
+
+    SmallFunction(SmallFunction&& other) noexcept {
+      moveFrom(other);
+    }
+
+    SmallFunction& operator=(SmallFunction&& other) noexcept {
+      if(this == &other) return *this;
+      reset();
+      moveFrom(other);
+      return *this;
+    }
+
+    SmallFunction(const SmallFunction&) = delete;
+    SmallFunction& operator=(const SmallFunction&) = delete;
+
+    ~SmallFunction() {
+      reset();
+    }
+
+    void reset() noexcept {
+      if(manage) manage(Operation::Destroy, &storage, nullptr);
+      invoke = nullptr;
+      manage = nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+      return invoke != nullptr;
+    }
+
+    R operator()(Args... args) {
+      return invoke(&storage, std::forward<Args>(args)...);
+    }
+  };
+
+}
+
+#endif //PROMISE_SMALLFUNCTION_H
@@ -5,8 +5,12 @@
 #include <stdlib.h>
 
 #include "src/global.h"
+#include "src/EventLoop.h"
+#include "src/MediaEngine.h"
 #include "src/UserMedia.h"
 #include "src/PeerConnection.h"
+#include "src/PeerConnectionPool.h"
+#include "src/Metrics.h"
 #include <WebSocket.h>
 #include <json.hpp>
 #include <random>
@@ -32,6 +36,22 @@ int main(int argc, const char** argv) {
 
   bool offerer = std::string(argv[1]) == "call";
 
+  webrtc::EventLoopConfiguration loopConfig;
+  loopConfig.threadsCount = argc > 2 ? atoi(argv[2]) : 1;
+
+  /// GET /metrics on the loopback, port 0 turns it off
+  webrtc::MetricsServerConfiguration metricsConfig;
+  if(argc > 3) metricsConfig.port = atoi(argv[3]);
+  std::unique_ptr<webrtc::MetricsServer> metricsServer;
+  if(metricsConfig.port > 0) {
+    metricsServer.reset(new webrtc::MetricsServer());
+    metricsServer->init(metricsConfig);
+  }
+  std::shared_ptr<webrtc::EventLoop> eventLoop = std::make_shared<webrtc::EventLoop>();
+  eventLoop->init(loopConfig);
+  std::shared_ptr<webrtc::MediaEngine> mediaEngine = std::make_shared<webrtc::MediaEngine>();
+  mediaEngine->init(eventLoop);
+
   webrtc::UserMediaConstraints constraints;
   std::shared_ptr<webrtc::UserMedia> userMedia = webrtc::UserMedia::getUserMedia(constraints);
 
@@ -44,8 +64,15 @@ int main(int argc, const char** argv) {
       }
   };
   pcConfig.iceServers = iceServers;
-  std::shared_ptr<webrtc::PeerConnection> peerConnection = std::make_shared<webrtc::PeerConnection>();
-  peerConnection->init(pcConfig);
+
+  /// Gathering (TURN allocation included) starts with the loop, before the signalling server is even reached
+  webrtc::PeerConnectionPoolConfiguration poolConfig;
+  poolConfig.size = 1;
+  poolConfig.connectionConfiguration = pcConfig;
+  std::shared_ptr<webrtc::PeerConnectionPool> pcPool = std::make_shared<webrtc::PeerConnectionPool>();
+  pcPool->init(eventLoop, mediaEngine, poolConfig);
+  eventLoop->start();
+  std::shared_ptr<webrtc::PeerConnection> activeConnection; /* set on open, read by the reader thread */
 
   std::string uuid = generateRandomId(10);
 
@@ -57,31 +84,39 @@ int main(int argc, const char** argv) {
 
   std::shared_ptr<wsxx::WebSocket> webSocket = std::make_shared<wsxx::WebSocket>(
       "ws://localhost:8338/",
-      [&webSocket, peerConnection, userMedia, uuid, &wsThreadDesc, &wsThread, offerer]() { // on open
+      [&webSocket, &activeConnection, pcPool, userMedia, uuid, &wsThreadDesc, &wsThread, offerer]() { // on open
         if(!pj_thread_is_registered()) pj_thread_register("websocket", wsThreadDesc, &wsThread);
+        std::shared_ptr<webrtc::PeerConnection> peerConnection = pcPool->acquire();
+        std::atomic_store(&activeConnection, peerConnection);
+        peerConnection->onIceCandidate = [&webSocket, uuid](const webrtc::IceCandidate* candidate) {
+          nlohmann::json msg = {{"ice",  candidate ? candidate->toJson() : nlohmann::json(nullptr)},
+                                {"uuid", uuid}};
+          webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
+        };
         peerConnection->addStream(userMedia);
         if(offerer) {
+#if PROMISE_HAS_COROUTINES
+          peerConnection->negotiate(nullptr, [&webSocket, uuid](const nlohmann::json& offer) {
+            nlohmann::json msg = {{"sdp",  offer},
+                                  {"uuid", uuid}};
+            webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
+          })->onFailed([](const promise::Error& error) { printf("CALL FAILED %s\n", error.message); });
+#else
           peerConnection->createOffer()->onResolved([=](nlohmann::json offer) {
-            peerConnection->setLocalDescription(offer);
             nlohmann::json msg = {{"sdp",  offer},
                                   {"uuid", uuid}};
             webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-            for (auto &candidate : peerConnection->localCandidates) {
-              nlohmann::json msg = {{"ice",  candidate},
-                                    {"uuid", uuid}};
-              webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-            }
-            {
-              nlohmann::json msg = {{"ice",  nullptr},
-                                    {"uuid", uuid}};
-              webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-            }
+            /// Candidates are trickled from here on, so the description has to go out first
+            peerConnection->setLocalDescription(offer);
           });
+#endif
         }
       },
-      [&webSocket, &uuid, &peerConnection, &wsReaderThreadDesc, &wsReaderThread, offerer]
+      [&webSocket, &uuid, &activeConnection, &wsReaderThreadDesc, &wsReaderThread, offerer]
           (std::string data, wsxx::WebSocket::PacketType type) {
         if(!pj_thread_is_registered()) pj_thread_register("websocket_reader", wsReaderThreadDesc, &wsReaderThread);
+        std::shared_ptr<webrtc::PeerConnection> peerConnection = std::atomic_load(&activeConnection);
+        if(!peerConnection) return;
         auto msg = nlohmann::json::parse(data);
         if(msg["uuid"] == uuid) return;
         printf("WSMSG %s\n", data.c_str());
@@ -90,25 +125,27 @@ int main(int argc, const char** argv) {
         if(sdp != msg.end()) { // Handle SDP message
           printf("SDP MSD\n");
           auto sdpString = (*sdp)["sdp"];
+#if PROMISE_HAS_COROUTINES
+          if((*sdp)["type"] == "offer" && !offerer) {
+            peerConnection->negotiate(*sdp, [&webSocket, uuid](const nlohmann::json& answer) {
+              nlohmann::json msg = {{"sdp", answer},
+                                    {"uuid", uuid}};
+              webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
+            })->onFailed([](const promise::Error& error) { printf("CALL FAILED %s\n", error.message); });
+          } else {
+            peerConnection->setRemoteDescription(*sdp);
+          }
+#else
           peerConnection->setRemoteDescription(*sdp);
           if((*sdp)["type"] == "offer" && !offerer) {
             peerConnection->createAnswer()->onResolved([=](nlohmann::json answer) {
-              peerConnection->setLocalDescription(answer);
               nlohmann::json msg = {{"sdp", answer},
                                     {"uuid", uuid}};
               webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-              for (auto &candidate : peerConnection->localCandidates) {
-                nlohmann::json msg = {{"ice",  candidate},
-                                      {"uuid", uuid}};
-                webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-              }
-              {
-                nlohmann::json msg = {{"ice",  nullptr},
-                                      {"uuid", uuid}};
-                webSocket->send(msg.dump(2), wsxx::WebSocket::PacketType::Text);
-              }
+              peerConnection->setLocalDescription(answer);
             });
           }
+#endif
         } else if(ice != msg.end()) {
           printf("ICE MSD\n");
           peerConnection->addIceCandidate(*ice);
@@ -119,11 +156,11 @@ int main(int argc, const char** argv) {
   );
 
   while (true) {
-    const pj_time_val delay = {0, 10};
-    pj_timer_heap_poll(peerConnection->timerHeap, nullptr);
-    pj_ioqueue_poll(peerConnection->ioqueue, &delay);
+    pj_thread_sleep(1000);
   }
 
+  eventLoop->stop();
+  metricsServer.reset(); // its pool goes back before the caching pool is destroyed
   webrtc::destroy();
 
   /* Done. */
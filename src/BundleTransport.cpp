@@ -0,0 +1,326 @@
+#include "BundleTransport.h"
+
+namespace webrtc {
+
+  static const char* MID_EXTENSION_URI = "urn:ietf:params:rtp-hdrext:sdes:mid";
+
+  void bundleRtpCb2(pjmedia_tp_cb_param *param) {
+    BundleGroup* group = (BundleGroup*)param->user_data;
+    pjmedia_transport_attach_param attachParam;
+    if(!group->route((const pj_uint8_t*)param->pkt, param->size, &attachParam)) return;
+    if(attachParam.rtp_cb2) {
+      pjmedia_tp_cb_param memberParam = *param;
+      memberParam.user_data = attachParam.user_data;
+      attachParam.rtp_cb2(&memberParam);
+    } else if(attachParam.rtp_cb) {
+      attachParam.rtp_cb(attachParam.user_data, param->pkt, param->size);
+    }
+  }
+
+  void bundleRtcpCb(void *user_data, void *pkt, pj_ssize_t size) {
+    BundleGroup* group = (BundleGroup*)user_data;
+    if(size < 8) return;
+    pj_uint32_t ssrc;
+    pj_memcpy(&ssrc, (pj_uint8_t*)pkt + 4, 4);
+    ssrc = pj_ntohl(ssrc);
+    /// Copied under the lock, members can be detached or destroyed from the connection's strand meanwhile
+    std::vector<pjmedia_transport_attach_param> targets;
+    {
+      std::lock_guard<std::mutex> lock(group->mutex);
+      auto it = group->ssrcTable.find(ssrc);
+      if(it != group->ssrcTable.end()) {
+        if(it->second->attached) targets.push_back(it->second->attachParam);
+      } else {
+        // reports for unknown senders go to every stream
+        for(auto member : group->members) if(member->attached) targets.push_back(member->attachParam);
+      }
+    }
+    for(auto& attachParam : targets) {
+      if(attachParam.rtcp_cb) attachParam.rtcp_cb(attachParam.user_data, pkt, size);
+    }
+  }
+
+  static pj_status_t bundleGetInfo(pjmedia_transport *tp, pjmedia_transport_info *info) {
+    BundleMember* member = (BundleMember*)tp;
+    return pjmedia_transport_get_info(member->group->transport, info);
+  }
+
+  static pj_status_t bundleAttach2(pjmedia_transport *tp, pjmedia_transport_attach_param *attachParam) {
+    BundleMember* member = (BundleMember*)tp;
+    return member->group->attach(member, attachParam);
+  }
+
+  static pj_status_t bundleAttach(pjmedia_transport *tp, void *user_data,
+                                  const pj_sockaddr_t *rem_addr, const pj_sockaddr_t *rem_rtcp, unsigned addr_len,
+                                  void (*rtp_cb)(void*, void*, pj_ssize_t),
+                                  void (*rtcp_cb)(void*, void*, pj_ssize_t)) {
+    pjmedia_transport_attach_param attachParam;
+    pj_bzero(&attachParam, sizeof(attachParam));
+    attachParam.user_data = user_data;
+    pj_memcpy(&attachParam.rem_addr, rem_addr, addr_len);
+    pj_memcpy(&attachParam.rem_rtcp, rem_rtcp, addr_len);
+    attachParam.addr_len = addr_len;
+    attachParam.rtp_cb = rtp_cb;
+    attachParam.rtcp_cb = rtcp_cb;
+    return bundleAttach2(tp, &attachParam);
+  }
+
+  static void bundleDetach(pjmedia_transport *tp, void *user_data) {
+    BundleMember* member = (BundleMember*)tp;
+    member->group->detach(member);
+  }
+
+  static pj_status_t bundleSendRtp(pjmedia_transport *tp, const void *pkt, pj_size_t size) {
+    BundleMember* member = (BundleMember*)tp;
+    return pjmedia_transport_send_rtp(member->group->transport, pkt, size);
+  }
+
+  static pj_status_t bundleSendRtcp(pjmedia_transport *tp, const void *pkt, pj_size_t size) {
+    BundleMember* member = (BundleMember*)tp;
+    return pjmedia_transport_send_rtcp(member->group->transport, pkt, size);
+  }
+
+  static pj_status_t bundleSendRtcp2(pjmedia_transport *tp, const pj_sockaddr_t *addr, unsigned addr_len,
+                                     const void *pkt, pj_size_t size) {
+    BundleMember* member = (BundleMember*)tp;
+    return pjmedia_transport_send_rtcp2(member->group->transport, addr, addr_len, pkt, size);
+  }
+
+  /* Negotiation happens on the shared transport, members have nothing to add */
+  static pj_status_t bundleMediaCreate(pjmedia_transport *tp, pj_pool_t *sdp_pool, unsigned options,
+                                       const pjmedia_sdp_session *remote_sdp, unsigned media_index) {
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t bundleEncodeSdp(pjmedia_transport *tp, pj_pool_t *sdp_pool, pjmedia_sdp_session *sdp_local,
+                                     const pjmedia_sdp_session *rem_sdp, unsigned media_index) {
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t bundleMediaStart(pjmedia_transport *tp, pj_pool_t *tmp_pool,
+                                      const pjmedia_sdp_session *sdp_local, const pjmedia_sdp_session *sdp_remote,
+                                      unsigned media_index) {
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t bundleMediaStop(pjmedia_transport *tp) {
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t bundleSimulateLost(pjmedia_transport *tp, pjmedia_dir dir, unsigned pct_lost) {
+    BundleMember* member = (BundleMember*)tp;
+    return pjmedia_transport_simulate_lost(member->group->transport, dir, pct_lost);
+  }
+
+  static pj_status_t bundleDestroy(pjmedia_transport *tp) {
+    BundleMember* member = (BundleMember*)tp;
+    member->group->destroy(member);
+    return PJ_SUCCESS;
+  }
+
+  static pjmedia_transport_op bundleOps = {
+      &bundleGetInfo,
+      &bundleAttach,
+      &bundleDetach,
+      &bundleSendRtp,
+      &bundleSendRtcp,
+      &bundleSendRtcp2,
+      &bundleMediaCreate,
+      &bundleEncodeSdp,
+      &bundleMediaStart,
+      &bundleMediaStop,
+      &bundleSimulateLost,
+      &bundleDestroy,
+      &bundleAttach2
+  };
+
+  BundleGroup::BundleGroup(pjmedia_transport* transportp) {
+    transport = transportp;
+    attachedCount = 0;
+    midExtensionId = 0;
+  }
+
+  pjmedia_transport* BundleGroup::createMember(pj_pool_t* pool, unsigned mediaIndex) {
+    BundleMember* member = PJ_POOL_ZALLOC_T(pool, BundleMember);
+    pj_ansi_snprintf(member->base.name, PJ_MAX_OBJ_NAME, "bundle%u", mediaIndex);
+    member->base.type = transport->type;
+    member->base.op = &bundleOps;
+    member->group = this;
+    member->mediaIndex = mediaIndex;
+    member->attached = false;
+    std::lock_guard<std::mutex> lock(mutex);
+    members.push_back(member);
+    return &member->base;
+  }
+
+  void BundleGroup::setRemoteDescription(const pjmedia_sdp_session* remoteSdp) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<int, int> payloadTypeUses;
+    for(auto member : members) {
+      if(member->mediaIndex >= remoteSdp->media_count) continue;
+      const pjmedia_sdp_media* media = remoteSdp->media[member->mediaIndex];
+      for(unsigned i = 0; i < media->attr_count; i++) {
+        const pjmedia_sdp_attr* attr = media->attr[i];
+        std::string name(attr->name.ptr, attr->name.slen);
+        std::string value(attr->value.ptr, attr->value.slen);
+        if(name == "mid") {
+          midTable[value] = member;
+        } else if(name == "ssrc") {
+          ssrcTable[(pj_uint32_t)strtoul(value.c_str(), nullptr, 10)] = member;
+        }
+      }
+      int extensionId = findMidExtension(media);
+      if(extensionId) midExtensionId = extensionId;
+      for(unsigned i = 0; i < media->desc.fmt_count; i++) {
+        int payloadType = (int)pj_strtoul(&media->desc.fmt[i]);
+        payloadTypeUses[payloadType]++;
+        payloadTypeTable[payloadType] = member;
+      }
+    }
+    /// Identical codec lists, as our audio m-lines have, leave nothing to route by
+    for(auto& uses : payloadTypeUses) if(uses.second > 1) payloadTypeTable.erase(uses.first);
+  }
+
+  static std::string readMidExtension(const pj_uint8_t* packet, pj_ssize_t size, int extensionId) {
+    if(!extensionId || !(packet[0] & 0x10)) return "";
+    pj_ssize_t offset = 12 + 4 * (packet[0] & 0x0f);
+    if(offset + 4 > size) return "";
+    unsigned profile = (packet[offset] << 8) | packet[offset+1];
+    pj_ssize_t end = offset + 4 + 4 * ((packet[offset+2] << 8) | packet[offset+3]);
+    if(end > size) return "";
+    offset += 4;
+    bool oneByte = profile == 0xBEDE;
+    if(!oneByte && (profile & 0xfff0) != 0x1000) return "";
+    while(offset < end) {
+      int id, length;
+      if(oneByte) {
+        if(packet[offset] == 0) { offset++; continue; } // padding
+        id = packet[offset] >> 4;
+        length = (packet[offset] & 0x0f) + 1;
+        if(id == 15) break;
+        offset += 1;
+      } else {
+        if(packet[offset] == 0) { offset++; continue; }
+        if(offset + 2 > end) break;
+        id = packet[offset];
+        length = packet[offset+1];
+        offset += 2;
+      }
+      if(offset + length > end) break;
+      if(id == extensionId) return std::string((const char*)packet + offset, length);
+      offset += length;
+    }
+    return "";
+  }
+
+  bool BundleGroup::route(const pj_uint8_t* packet, pj_ssize_t size, pjmedia_transport_attach_param* attachParam) {
+    if(size < 12) return false;
+    pj_uint32_t ssrc;
+    pj_memcpy(&ssrc, packet + 8, 4);
+    ssrc = pj_ntohl(ssrc);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = ssrcTable.find(ssrc);
+    if(it != ssrcTable.end()) {
+      if(!it->second->attached) return false;
+      *attachParam = it->second->attachParam;
+      return true;
+    }
+
+    /// Unknown SSRC, latch it to the m-line named by the MID header extension or owning the payload type
+    BundleMember* member = nullptr;
+    std::string mid = readMidExtension(packet, size, midExtensionId);
+    auto midIt = midTable.find(mid);
+    auto payloadTypeIt = payloadTypeTable.find(packet[1] & 0x7f);
+    if(midIt != midTable.end()) member = midIt->second;
+    else if(payloadTypeIt != payloadTypeTable.end()) member = payloadTypeIt->second;
+    else if(members.size() == 1) member = members[0];
+    if(!member) return false;
+    ssrcTable[ssrc] = member;
+    if(!member->attached) return false;
+    *attachParam = member->attachParam;
+    return true;
+  }
+
+  pj_status_t BundleGroup::attach(BundleMember* member, pjmedia_transport_attach_param *attachParam) {
+    std::unique_lock<std::mutex> lock(mutex);
+    member->attachParam = *attachParam;
+    member->attached = true;
+    if(attachedCount++ > 0) return PJ_SUCCESS;
+    lock.unlock();
+
+    /// First stream attaches the group itself to the shared transport
+    pjmedia_transport_attach_param groupParam = *attachParam;
+    groupParam.user_data = (void*)this;
+    groupParam.rtp_cb = nullptr;
+    groupParam.rtp_cb2 = &bundleRtpCb2;
+    groupParam.rtcp_cb = &bundleRtcpCb;
+    pj_status_t status = pjmedia_transport_attach2(transport, &groupParam);
+    if(status != PJ_SUCCESS) {
+      lock.lock();
+      attachedCount--;
+      member->attached = false;
+    }
+    return status;
+  }
+
+  void BundleGroup::detach(BundleMember* member) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!member->attached) return;
+    member->attached = false;
+    if(--attachedCount > 0) return;
+    lock.unlock();
+    pjmedia_transport_detach(transport, (void*)this);
+  }
+
+  void BundleGroup::destroy(BundleMember* member) {
+    detach(member);
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto it = ssrcTable.begin(); it != ssrcTable.end();) {
+      if(it->second == member) it = ssrcTable.erase(it);
+      else it++;
+    }
+    for(auto it = midTable.begin(); it != midTable.end();) {
+      if(it->second == member) it = midTable.erase(it);
+      else it++;
+    }
+    for(auto it = payloadTypeTable.begin(); it != payloadTypeTable.end();) {
+      if(it->second == member) it = payloadTypeTable.erase(it);
+      else it++;
+    }
+    for(auto it = members.begin(); it != members.end(); it++) {
+      if(*it != member) continue;
+      members.erase(it);
+      break;
+    }
+  }
+
+  void addMidExtension(pj_pool_t* pool, pjmedia_sdp_media* media, int extensionId) {
+    std::string value = std::to_string(extensionId) + " " + MID_EXTENSION_URI;
+    pj_str_t extmap = pj_strdup3(pool, value.c_str());
+    pjmedia_sdp_media_add_attr(media, pjmedia_sdp_attr_create(pool, "extmap", &extmap));
+  }
+
+  int findMidExtension(const pjmedia_sdp_media* media) {
+    for(unsigned i = 0; i < media->attr_count; i++) {
+      const pjmedia_sdp_attr* attr = media->attr[i];
+      if(pj_strcmp2(&attr->name, "extmap") != 0) continue;
+      std::string value(attr->value.ptr, attr->value.slen);
+      if(value.find(MID_EXTENSION_URI) != std::string::npos) return atoi(value.c_str());
+    }
+    return 0;
+  }
+
+  void copyBundleAttributes(pj_pool_t* pool, pjmedia_sdp_session* sdp, unsigned from, unsigned to) {
+    static const char* names[] = { "ice-ufrag", "ice-pwd", "ice-options", "fingerprint", "setup", "rtcp-mux" };
+    pjmedia_sdp_media* source = sdp->media[from];
+    pjmedia_sdp_media* target = sdp->media[to];
+    target->desc.transport = source->desc.transport;
+    for(auto name : names) {
+      pjmedia_sdp_attr* attr = pjmedia_sdp_media_find_attr2(source, name, nullptr);
+      if(!attr || pjmedia_sdp_media_find_attr2(target, name, nullptr)) continue;
+      pjmedia_sdp_media_add_attr(target, pjmedia_sdp_attr_clone(pool, attr));
+    }
+  }
+
+}
@@ -0,0 +1,67 @@
+#ifndef PJWEBRTC_BUNDLETRANSPORT_H
+#define PJWEBRTC_BUNDLETRANSPORT_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "global.h"
+
+namespace webrtc {
+
+  class BundleGroup;
+
+  /// pjmedia_transport seen by the stream of one bundled m-line
+  struct BundleMember {
+    pjmedia_transport base;
+    BundleGroup* group;
+    unsigned mediaIndex;
+    pjmedia_transport_attach_param attachParam; /* attachParam and attached under group->mutex */
+    bool attached;
+  };
+
+  /// Shares one ICE/DTLS transport between all m-lines of a=group:BUNDLE, incoming RTP is routed by SSRC, MID
+  /// or, when neither is known, by a payload type only one m-line uses.
+  class BundleGroup {
+  private:
+    std::mutex mutex;
+    std::vector<BundleMember*> members;
+    std::unordered_map<pj_uint32_t, BundleMember*> ssrcTable;
+    std::unordered_map<std::string, BundleMember*> midTable;
+    std::unordered_map<int, BundleMember*> payloadTypeTable; /* payload types unique to one m-line */
+    int attachedCount;
+    int midExtensionId;
+
+    /// Copies the attach parameters of the member the packet belongs to, false when there is none or it's detached
+    bool route(const pj_uint8_t* packet, pj_ssize_t size, pjmedia_transport_attach_param* attachParam);
+
+    friend void bundleRtpCb2(pjmedia_tp_cb_param *param);
+    friend void bundleRtcpCb(void *user_data, void *pkt, pj_ssize_t size);
+
+  public:
+    pjmedia_transport* transport;
+
+    BundleGroup(pjmedia_transport* transportp);
+
+    pjmedia_transport* createMember(pj_pool_t* pool, unsigned mediaIndex);
+    void setRemoteDescription(const pjmedia_sdp_session* remoteSdp);
+
+    pj_status_t attach(BundleMember* member, pjmedia_transport_attach_param *attachParam);
+    void detach(BundleMember* member);
+    void destroy(BundleMember* member);
+  };
+
+  /// Extension id our offers give the MID header extension, answers take the id from the offer
+  static const int MID_EXTENSION_ID = 9;
+
+  /// Adds a=extmap for the MID RTP header extension
+  void addMidExtension(pj_pool_t* pool, pjmedia_sdp_media* media, int extensionId);
+  /// Id the m-line gives the MID header extension, 0 when it does not use it
+  int findMidExtension(const pjmedia_sdp_media* media);
+
+  /// Makes m-line `to` use the transport negotiated in m-line `from`
+  void copyBundleAttributes(pj_pool_t* pool, pjmedia_sdp_session* sdp, unsigned from, unsigned to);
+
+}
+
+#endif //PJWEBRTC_BUNDLETRANSPORT_H
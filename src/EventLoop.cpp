@@ -0,0 +1,181 @@
+#include "EventLoop.h"
+
+namespace webrtc {
+
+  int eventLoopWorker(void* arg) {
+    EventLoop* loop = (EventLoop*)arg;
+    while(loop->running) {
+      loop->poll();
+    }
+    return 0;
+  }
+
+  void eventLoopWakeupCb(pj_ioqueue_key_t *key, pj_ioqueue_op_key_t *op_key, pj_ssize_t bytes_read) {
+    EventLoop* loop = (EventLoop*)pj_ioqueue_get_user_data(key);
+    loop->runTasks();
+    loop->readWakeup();
+  }
+
+  void eventLoopTimerCb(pj_timer_heap_t *ht, pj_timer_entry *e) {
+    EventLoopTimer* timer = (EventLoopTimer*)e->user_data;
+    EventLoop* loop = timer->loop;
+    bool active;
+    {
+      std::lock_guard<std::mutex> lock(loop->timersMutex);
+      active = loop->timers.erase(timer->id) > 0;
+    }
+    if(active) timer->task();
+    delete timer;
+  }
+
+  EventLoop::EventLoop() {
+    pool = nullptr;
+    ioqueue = nullptr;
+    timerHeap = nullptr;
+    running = false;
+    wakeupPending = false;
+    wakeupSocket = PJ_INVALID_SOCKET;
+    wakeupKey = nullptr;
+    lastTimerId = 0;
+  }
+
+  void EventLoop::init(EventLoopConfiguration& configurationp) {
+    configuration = configurationp;
+
+    pj_status_t status;
+    pool = pj_pool_create(&cachingPool.factory, "EventLoop.pool", 4096, 4096, NULL);
+
+    /* Timer heap has its own lock, so it can be polled from every worker */
+    status = pj_timer_heap_create(pool, configuration.maxTimers, &timerHeap);
+    assert(status == PJ_SUCCESS);
+    wheel.init(configuration.wheelTickMsec);
+
+    status = pj_ioqueue_create(pool, configuration.maxHandles, &ioqueue);
+    assert(status == PJ_SUCCESS);
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0, &wakeupSocket);
+    assert(status == PJ_SUCCESS);
+    pj_str_t loopback = pj_str((char*)"127.0.0.1");
+    pj_sockaddr_init(pj_AF_INET(), &wakeupAddress, &loopback, 0);
+    status = pj_sock_bind(wakeupSocket, &wakeupAddress, pj_sockaddr_get_len(&wakeupAddress));
+    assert(status == PJ_SUCCESS);
+    int addressLength = sizeof(wakeupAddress);
+    pj_sock_getsockname(wakeupSocket, &wakeupAddress, &addressLength);
+
+    pj_ioqueue_callback callbacks;
+    pj_bzero(&callbacks, sizeof(callbacks));
+    callbacks.on_read_complete = &eventLoopWakeupCb;
+    status = pj_ioqueue_register_sock(pool, ioqueue, wakeupSocket, (void*)this, &callbacks, &wakeupKey);
+    assert(status == PJ_SUCCESS);
+    pj_ioqueue_op_key_init(&wakeupOpKey, sizeof(wakeupOpKey));
+    readWakeup();
+  }
+
+  void EventLoop::readWakeup() {
+    pj_status_t status;
+    do {
+      pj_ssize_t size = sizeof(wakeupBuffer);
+      status = pj_ioqueue_recv(wakeupKey, &wakeupOpKey, wakeupBuffer, &size, 0);
+      if(status == PJ_SUCCESS) runTasks(); // datagram was already there, no callback for it
+    } while(status == PJ_SUCCESS);
+  }
+
+  void EventLoop::runTasks() {
+    std::vector<promise::Task> ready;
+    {
+      std::lock_guard<std::mutex> lock(tasksMutex);
+      ready.swap(tasks);
+      wakeupPending = false;
+    }
+    for(auto& task : ready) task();
+  }
+
+  void EventLoop::execute(promise::Task task) {
+    bool wakeup;
+    {
+      std::lock_guard<std::mutex> lock(tasksMutex);
+      tasks.push_back(std::move(task));
+      wakeup = !wakeupPending;
+      wakeupPending = true;
+    }
+    if(!wakeup) return; // one datagram in flight is enough for the whole queue
+    char byte = 0;
+    pj_ssize_t size = 1;
+    pj_sock_sendto(wakeupSocket, &byte, &size, 0, &wakeupAddress, pj_sockaddr_get_len(&wakeupAddress));
+  }
+
+  unsigned long EventLoop::setTimeout(promise::Task task, int msec) {
+    EventLoopTimer* timer = new EventLoopTimer;
+    timer->task = std::move(task);
+    timer->loop = this;
+    pj_timer_entry_init(&timer->entry, 0, (void*)timer, &eventLoopTimerCb);
+    pj_time_val delay = {msec / 1000, msec % 1000};
+
+    std::lock_guard<std::mutex> lock(timersMutex);
+    timer->id = ++lastTimerId;
+    timers[timer->id] = timer;
+    pj_status_t status = pj_timer_heap_schedule(timerHeap, &timer->entry, &delay);
+    assert(status == PJ_SUCCESS);
+    return timer->id;
+  }
+
+  bool EventLoop::clearTimeout(unsigned long timeoutId) {
+    std::lock_guard<std::mutex> lock(timersMutex);
+    auto it = timers.find(timeoutId);
+    if(it == timers.end()) return false;
+    EventLoopTimer* timer = it->second;
+    timers.erase(it);
+    /* Already popped by a worker when nothing was cancelled, its callback sees the missing id and frees it */
+    if(pj_timer_heap_cancel(timerHeap, &timer->entry) > 0) delete timer;
+    return true;
+  }
+
+  void EventLoop::start() {
+    pj_status_t status;
+    running = true;
+    for(int i = 0; i < configuration.threadsCount; i++) {
+      pj_thread_t* thread;
+      status = pj_thread_create(pool, "eventloop", &eventLoopWorker, (void*)this,
+                                PJ_THREAD_DEFAULT_STACK_SIZE, 0, &thread);
+      assert(status == PJ_SUCCESS);
+      threads.push_back(thread);
+    }
+  }
+
+  void EventLoop::stop() {
+    running = false;
+    for(auto thread : threads) {
+      pj_thread_join(thread);
+      pj_thread_destroy(thread);
+    }
+    threads.clear();
+  }
+
+  int EventLoop::poll() {
+    pj_time_val timeout = {0, 0};
+    pj_time_val maxTimeout = {0, configuration.maxPollMsec};
+    int count = pj_timer_heap_poll(timerHeap, &timeout);
+    count += wheel.poll();
+
+    /* next_delay is PJ_MAXINT32 when the heap is empty */
+    if(PJ_TIME_VAL_GT(timeout, maxTimeout)) timeout = maxTimeout;
+
+    int events = pj_ioqueue_poll(ioqueue, &timeout);
+    if(events < 0) {
+      /* Don't spin on a broken ioqueue */
+      pj_thread_sleep(PJ_TIME_VAL_MSEC(timeout));
+      return count;
+    }
+    return count + events;
+  }
+
+  EventLoop::~EventLoop() {
+    if(running) stop();
+    for(auto& timer : timers) delete timer.second;
+    if(wakeupKey) pj_ioqueue_unregister(wakeupKey); // closes wakeupSocket too
+    if(timerHeap) pj_timer_heap_destroy(timerHeap);
+    if(ioqueue) pj_ioqueue_destroy(ioqueue);
+    if(pool) pj_pool_release(pool);
+  }
+
+}
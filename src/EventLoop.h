@@ -0,0 +1,90 @@
+#ifndef PJWEBRTC_EVENTLOOP_H
+#define PJWEBRTC_EVENTLOOP_H
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "global.h"
+#include "Executor.h"
+#include "TimingWheel.h"
+
+namespace webrtc {
+
+  struct EventLoopConfiguration {
+    int threadsCount = 1;
+    int maxHandles = PJ_IOQUEUE_MAX_HANDLES;
+    int maxTimers = 4096;
+    int maxPollMsec = 10;
+    /// Resolution of the timing wheel, it only advances when a worker polls so finer than maxPollMsec won't help
+    int wheelTickMsec = 10;
+  };
+
+  class EventLoop;
+
+  struct EventLoopTimer {
+    pj_timer_entry entry;
+    promise::Task task;
+    EventLoop* loop;
+    unsigned long id;
+  };
+
+  /// One ioqueue and timer heap shared by many PeerConnections, polled by a pool of worker threads.
+  class EventLoop : public promise::Executor {
+  private:
+    pj_pool_t* pool;
+    std::vector<pj_thread_t*> threads;
+    std::atomic<bool> running;
+
+    /* execute() queue, a datagram to our own loopback socket wakes a worker blocked in the ioqueue */
+    std::mutex tasksMutex;
+    std::vector<promise::Task> tasks;
+    bool wakeupPending;
+    pj_sock_t wakeupSocket;
+    pj_sockaddr wakeupAddress;
+    pj_ioqueue_key_t* wakeupKey;
+    pj_ioqueue_op_key_t wakeupOpKey;
+    char wakeupBuffer[16];
+
+    /* setTimeout() timers by id, an id missing here means the timer was cleared */
+    std::mutex timersMutex;
+    std::unordered_map<unsigned long, EventLoopTimer*> timers;
+    unsigned long lastTimerId;
+
+    void readWakeup();
+    void runTasks();
+
+    friend int eventLoopWorker(void* arg);
+    friend void eventLoopWakeupCb(pj_ioqueue_key_t *key, pj_ioqueue_op_key_t *op_key, pj_ssize_t bytes_read);
+    friend void eventLoopTimerCb(pj_timer_heap_t *ht, pj_timer_entry *e);
+
+  public:
+    pj_ioqueue_t* ioqueue;
+    pj_timer_heap_t* timerHeap;
+    /// Per-connection periodic work, one batch per tick for every connection on this loop
+    TimingWheel wheel;
+
+    EventLoopConfiguration configuration;
+
+    EventLoop();
+    ~EventLoop();
+
+    void init(EventLoopConfiguration& configurationp);
+
+    /// Spawns configuration.threadsCount workers, each running poll() until stop() is called.
+    void start();
+    void stop();
+
+    /// Runs due timers and wheel entries and waits for I/O no longer than the next timer or maxPollMsec.
+    int poll();
+
+    /// Runs task on one of the workers, callable from any thread
+    void execute(promise::Task task) override;
+    /// Task runs on a worker from the timer heap, callable from any thread
+    unsigned long setTimeout(promise::Task task, int msec) override;
+    bool clearTimeout(unsigned long timeoutId) override;
+  };
+
+}
+
+#endif //PJWEBRTC_EVENTLOOP_H
@@ -0,0 +1,77 @@
+#include "HdrHistogram.h"
+
+namespace webrtc {
+
+  static const unsigned long subBucketMask = (1ul << HdrHistogram::subBucketBits) - 1;
+  static const int subBucketHalfBits = HdrHistogram::subBucketBits - 1;
+  static const unsigned long largestValue = (1ul << HdrHistogram::valueBits) - 1;
+
+  HdrHistogram::HdrHistogram() : totalCount(0), maxValue(0) {
+    for(auto& count : counts) count.store(0, std::memory_order_relaxed);
+  }
+
+  int HdrHistogram::indexOf(unsigned long value) {
+    /// Bucket is the power of two above the sub-bucket range, sub-bucket the top subBucketBits of value
+    int magnitude = 63 - __builtin_clzl(value | subBucketMask);
+    int bucket = magnitude - subBucketHalfBits;
+    return (bucket << subBucketHalfBits) + (int)(value >> bucket);
+  }
+
+  unsigned long HdrHistogram::highestEquivalent(int index) {
+    int bucket = 0;
+    unsigned long subBucket = index;
+    if(index > (int)subBucketMask) {
+      bucket = (index >> subBucketHalfBits) - 1;
+      subBucket = index - (bucket << subBucketHalfBits);
+    }
+    return ((subBucket + 1) << bucket) - 1;
+  }
+
+  void HdrHistogram::record(unsigned long value) {
+    if(value > largestValue) value = largestValue;
+    counts[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+    totalCount.fetch_add(1, std::memory_order_relaxed);
+    unsigned long currentMax = maxValue.load(std::memory_order_relaxed);
+    while(value > currentMax && !maxValue.compare_exchange_weak(currentMax, value, std::memory_order_relaxed));
+  }
+
+  void HdrHistogram::add(const HdrHistogram& other) {
+    for(int i = 0; i < countsLength; i++) {
+      pj_uint32_t count = other.counts[i].load(std::memory_order_relaxed);
+      if(count) counts[i].fetch_add(count, std::memory_order_relaxed);
+    }
+    totalCount.fetch_add(other.count(), std::memory_order_relaxed);
+    unsigned long otherMax = other.max();
+    unsigned long currentMax = maxValue.load(std::memory_order_relaxed);
+    while(otherMax > currentMax && !maxValue.compare_exchange_weak(currentMax, otherMax, std::memory_order_relaxed));
+  }
+
+  unsigned long HdrHistogram::count() const {
+    return totalCount.load(std::memory_order_relaxed);
+  }
+
+  unsigned long HdrHistogram::max() const {
+    return maxValue.load(std::memory_order_relaxed);
+  }
+
+  unsigned long HdrHistogram::percentile(double q) const {
+    /* Summing the buckets instead of trusting totalCount keeps a concurrent record() from pushing us past the end */
+    unsigned long total = 0;
+    for(auto& count : counts) total += count.load(std::memory_order_relaxed);
+    if(total == 0) return 0;
+    unsigned long target = (unsigned long)(q * total + 0.5);
+    if(target < 1) target = 1;
+    if(target > total) target = total;
+    unsigned long seen = 0;
+    for(int i = 0; i < countsLength; i++) {
+      seen += counts[i].load(std::memory_order_relaxed);
+      if(seen >= target) {
+        unsigned long value = highestEquivalent(i);
+        unsigned long currentMax = max();
+        return value < currentMax ? value : currentMax;
+      }
+    }
+    return max();
+  }
+
+}
@@ -0,0 +1,40 @@
+#ifndef PJWEBRTC_HDRHISTOGRAM_H
+#define PJWEBRTC_HDRHISTOGRAM_H
+
+#include <atomic>
+#include "global.h"
+
+namespace webrtc {
+
+  /// Log-linear (HDR) histogram of integer values, usec mostly. Fixed memory, relaxed atomic counts, so
+  /// record() is lock-free from any thread. Relative error is below 1 / 2^(subBucketBits - 1), about 3%.
+  class HdrHistogram {
+  public:
+    static constexpr int subBucketBits = 6;
+    /// Values from 2^valueBits up are counted as the largest one, a bit over an hour in usec
+    static constexpr int valueBits = 32;
+    static constexpr int countsLength = (valueBits - subBucketBits + 2) << (subBucketBits - 1);
+
+    HdrHistogram();
+
+    void record(unsigned long value);
+    /// Adds all counts of other, to merge per-stream histograms
+    void add(const HdrHistogram& other);
+
+    unsigned long count() const;
+    unsigned long max() const;
+    /// Smallest value with at least q of the recorded values at or below it, up to the bucket's precision
+    unsigned long percentile(double q) const;
+
+  private:
+    std::atomic<pj_uint32_t> counts[countsLength];
+    std::atomic<unsigned long> totalCount;
+    std::atomic<unsigned long> maxValue;
+
+    static int indexOf(unsigned long value);
+    static unsigned long highestEquivalent(int index);
+  };
+
+}
+
+#endif //PJWEBRTC_HDRHISTOGRAM_H
@@ -0,0 +1,196 @@
+#include "IceCandidate.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace webrtc {
+
+  static const char* CANDIDATE_PREFIX = "candidate:";
+  static const size_t CANDIDATE_PREFIX_LENGTH = 10;
+
+  struct CandidateTokenizer {
+    const char* position;
+    const char* end;
+
+    bool next(const char*& token, size_t& length) {
+      while(position < end && *position == ' ') position++;
+      if(position == end) return false;
+      token = position;
+      while(position < end && *position != ' ' && *position != '\r' && *position != '\n') position++;
+      length = position - token;
+      return true;
+    }
+  };
+
+  static bool tokenEquals(const char* token, size_t length, const char* literal) {
+    return strlen(literal) == length && pj_ansi_strnicmp(token, literal, length) == 0;
+  }
+
+  static bool parseNumber(const char* token, size_t length, pj_uint32_t& value) {
+    if(length == 0 || length > 10) return false;
+    pj_uint64_t result = 0;
+    for(size_t i = 0; i < length; i++) {
+      if(token[i] < '0' || token[i] > '9') return false;
+      result = result * 10 + (token[i] - '0');
+    }
+    if(result > 0xFFFFFFFFUL) return false;
+    value = (pj_uint32_t)result;
+    return true;
+  }
+
+  /// Literal addresses only, mDNS names and hostnames would block on a resolver
+  static bool parseAddress(const char* token, size_t length, pj_uint32_t port, pj_sockaddr& address) {
+    char buffer[PJ_INET6_ADDRSTRLEN];
+    if(length >= sizeof(buffer) || port > 65535) return false;
+    pj_memcpy(buffer, token, length);
+    buffer[length] = 0;
+    int af = memchr(token, ':', length) ? pj_AF_INET6() : pj_AF_INET();
+    pj_str_t addressString = pj_str(buffer);
+    if(pj_sockaddr_init(af, &address, nullptr, (pj_uint16_t)port) != PJ_SUCCESS) return false;
+    return pj_inet_pton(af, &addressString, pj_sockaddr_get_addr(&address)) == PJ_SUCCESS;
+  }
+
+  /* pj_sockaddr_has_addr asserts on a zeroed address */
+  static bool hasAddress(const pj_sockaddr* address) {
+    int af = address->addr.sa_family;
+    return (af == pj_AF_INET() || af == pj_AF_INET6()) && pj_sockaddr_has_addr(address);
+  }
+
+  IceCandidate::IceCandidate() {
+    component = 1;
+    priority = 0;
+    type = PJ_ICE_CAND_TYPE_HOST;
+    pj_bzero(&address, sizeof(address));
+    pj_bzero(&relatedAddress, sizeof(relatedAddress));
+    sdpMLineIndex = -1;
+  }
+
+  IceCandidate::IceCandidate(const pj_ice_sess_cand* cand) : IceCandidate() {
+    foundation = std::string(cand->foundation.ptr, cand->foundation.slen);
+    component = cand->comp_id;
+    priority = cand->prio;
+    address = cand->addr;
+    type = cand->type;
+    if(type != PJ_ICE_CAND_TYPE_HOST && hasAddress(&cand->rel_addr)) relatedAddress = cand->rel_addr;
+  }
+
+  bool IceCandidate::parse(const char* line, size_t length, IceCandidate& candidate) {
+    if(length >= CANDIDATE_PREFIX_LENGTH && pj_ansi_strnicmp(line, CANDIDATE_PREFIX, CANDIDATE_PREFIX_LENGTH) == 0) {
+      line += CANDIDATE_PREFIX_LENGTH;
+      length -= CANDIDATE_PREFIX_LENGTH;
+    }
+    CandidateTokenizer tokenizer = { line, line + length };
+    const char* token;
+    size_t tokenLength;
+    pj_uint32_t number;
+
+    if(!tokenizer.next(token, tokenLength) || tokenLength > 32) return false;
+    candidate.foundation.assign(token, tokenLength);
+    if(!tokenizer.next(token, tokenLength) || !parseNumber(token, tokenLength, number) || number < 1 || number > 256)
+      return false;
+    candidate.component = number;
+    if(!tokenizer.next(token, tokenLength) || !tokenEquals(token, tokenLength, "udp")) return false;
+    if(!tokenizer.next(token, tokenLength) || !parseNumber(token, tokenLength, candidate.priority)) return false;
+
+    const char* addressToken;
+    size_t addressLength;
+    if(!tokenizer.next(addressToken, addressLength)) return false;
+    if(!tokenizer.next(token, tokenLength) || !parseNumber(token, tokenLength, number)) return false;
+    if(!parseAddress(addressToken, addressLength, number, candidate.address)) {
+      /* Chrome hides host addresses behind <uuid>.local unless the page has media permissions */
+      static const size_t MDNS_SUFFIX_LENGTH = 6;
+      if(addressLength > MDNS_SUFFIX_LENGTH &&
+         pj_ansi_strnicmp(addressToken + addressLength - MDNS_SUFFIX_LENGTH, ".local", MDNS_SUFFIX_LENGTH) == 0)
+        printf("IGNORED MDNS CANDIDATE %.*s\n", (int)addressLength, addressToken);
+      return false;
+    }
+
+    if(!tokenizer.next(token, tokenLength) || !tokenEquals(token, tokenLength, "typ")) return false;
+    if(!tokenizer.next(token, tokenLength)) return false;
+    if(tokenEquals(token, tokenLength, "host")) candidate.type = PJ_ICE_CAND_TYPE_HOST;
+    else if(tokenEquals(token, tokenLength, "srflx")) candidate.type = PJ_ICE_CAND_TYPE_SRFLX;
+    else if(tokenEquals(token, tokenLength, "prflx")) candidate.type = PJ_ICE_CAND_TYPE_PRFLX;
+    else if(tokenEquals(token, tokenLength, "relay")) candidate.type = PJ_ICE_CAND_TYPE_RELAYED;
+    else return false;
+
+    /* Extensions come as name value pairs, only the related address matters */
+    const char* relatedToken = nullptr;
+    size_t relatedLength = 0;
+    pj_uint32_t relatedPort = 0;
+    const char* value;
+    size_t valueLength;
+    pj_bzero(&candidate.relatedAddress, sizeof(candidate.relatedAddress));
+    while(tokenizer.next(token, tokenLength) && tokenizer.next(value, valueLength)) {
+      if(tokenEquals(token, tokenLength, "raddr")) {
+        relatedToken = value;
+        relatedLength = valueLength;
+      } else if(tokenEquals(token, tokenLength, "rport")) {
+        parseNumber(value, valueLength, relatedPort);
+      }
+    }
+    if(relatedToken && !parseAddress(relatedToken, relatedLength, relatedPort, candidate.relatedAddress))
+      pj_bzero(&candidate.relatedAddress, sizeof(candidate.relatedAddress));
+    return true;
+  }
+
+  bool IceCandidate::parse(const std::string& line, IceCandidate& candidate) {
+    return parse(line.data(), line.size(), candidate);
+  }
+
+  bool IceCandidate::fromJson(const nlohmann::json& json, IceCandidate& candidate) {
+    if(!json.is_object()) return false;
+    auto line = json.find("candidate");
+    if(line == json.end() || !line->is_string()) return false;
+    if(!parse(line->get_ref<const std::string&>(), candidate)) return false;
+    auto mid = json.find("sdpMid");
+    if(mid != json.end() && mid->is_string()) candidate.sdpMid = mid->get<std::string>();
+    auto mLineIndex = json.find("sdpMLineIndex");
+    if(mLineIndex != json.end() && mLineIndex->is_number()) candidate.sdpMLineIndex = mLineIndex->get<int>();
+    auto ufrag = json.find("usernameFragment");
+    if(ufrag != json.end() && ufrag->is_string()) candidate.usernameFragment = ufrag->get<std::string>();
+    return true;
+  }
+
+  std::string IceCandidate::toAttribute() const {
+    char address[PJ_INET6_ADDRSTRLEN];
+    char buffer[256];
+    int length = pj_ansi_snprintf(buffer, sizeof(buffer), "%s %u udp %u %s %u typ %s",
+                                  foundation.c_str(), component, priority,
+                                  pj_sockaddr_print(&this->address, address, sizeof(address), 0),
+                                  pj_sockaddr_get_port(&this->address), pj_ice_get_cand_type_name(type));
+    if(hasAddress(&relatedAddress) && length > 0 && length < (int)sizeof(buffer)) {
+      length += pj_ansi_snprintf(buffer + length, sizeof(buffer) - length, " raddr %s rport %u",
+                                 pj_sockaddr_print(&relatedAddress, address, sizeof(address), 0),
+                                 pj_sockaddr_get_port(&relatedAddress));
+    }
+    if(length < 0) return "";
+    return std::string(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+  }
+
+  std::string IceCandidate::toString() const {
+    return CANDIDATE_PREFIX + toAttribute();
+  }
+
+  nlohmann::json IceCandidate::toJson() const {
+    nlohmann::json json = {
+        {"candidate", toString()},
+        {"sdpMid", sdpMid},
+        {"usernameFragment", usernameFragment}
+    };
+    /* The browser leaves sdpMLineIndex out rather than sending -1 when only the mid is known */
+    if(sdpMLineIndex >= 0) json["sdpMLineIndex"] = sdpMLineIndex;
+    return json;
+  }
+
+  void IceCandidate::toIceSessCand(pj_pool_t* pool, pj_ice_sess_cand* cand) const {
+    pj_bzero(cand, sizeof(pj_ice_sess_cand));
+    cand->type = type;
+    cand->comp_id = component;
+    cand->prio = priority;
+    cand->foundation = pj_strdup3(pool, foundation.c_str());
+    cand->addr = address;
+    cand->base_addr = address;
+    cand->rel_addr = relatedAddress;
+  }
+
+}
@@ -0,0 +1,46 @@
+#ifndef PJWEBRTC_ICECANDIDATE_H
+#define PJWEBRTC_ICECANDIDATE_H
+
+#include <string>
+#include "global.h"
+#include <pjnath.h>
+#include <json.hpp>
+
+namespace webrtc {
+
+  /// One a=candidate line with its signalling fields, what RTCIceCandidate carries in the browser.
+  struct IceCandidate {
+    std::string foundation;
+    unsigned component;
+    pj_uint32_t priority;
+    pj_sockaddr address; /* with port */
+    pj_ice_cand_type type;
+    pj_sockaddr relatedAddress; /* zero for host candidates */
+
+    std::string sdpMid;
+    int sdpMLineIndex;
+    std::string usernameFragment;
+
+    IceCandidate();
+    IceCandidate(const pj_ice_sess_cand* cand);
+
+    /// "candidate:..." or the bare attribute value, only UDP since pjnath has no ICE-TCP; no DNS lookups.
+    /// Addresses must be literal, so mDNS ".local" host candidates are logged and rejected, connectivity then
+    /// relies on the peer's srflx/relay candidates or on prflx candidates learned from its checks.
+    static bool parse(const char* line, size_t length, IceCandidate& candidate);
+    static bool parse(const std::string& line, IceCandidate& candidate);
+    /// Signalling form {"candidate", "sdpMid", "sdpMLineIndex", "usernameFragment"}
+    static bool fromJson(const nlohmann::json& json, IceCandidate& candidate);
+
+    /// Attribute value, without "candidate:"
+    std::string toAttribute() const;
+    /// RTCIceCandidate.candidate, with "candidate:"
+    std::string toString() const;
+    nlohmann::json toJson() const;
+    /// Foundation is duplicated into the pool
+    void toIceSessCand(pj_pool_t* pool, pj_ice_sess_cand* cand) const;
+  };
+
+}
+
+#endif //PJWEBRTC_ICECANDIDATE_H
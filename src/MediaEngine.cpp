@@ -0,0 +1,76 @@
+#include "MediaEngine.h"
+
+namespace webrtc {
+
+  MediaEngine::MediaEngine() {
+    mediaEndpoint = nullptr;
+    sdpTemplatesPool = nullptr;
+  }
+
+  void MediaEngine::init(std::shared_ptr<EventLoop> eventLoopp) {
+    eventLoop = eventLoopp;
+
+    pj_status_t status;
+
+    /* Endpoint polls nothing by itself, EventLoop workers drive its ioqueue */
+    status = pjmedia_endpt_create(&cachingPool.factory, eventLoop->ioqueue, 0, &mediaEndpoint);
+    assert(status == PJ_SUCCESS);
+    sdpTemplatesPool = pj_pool_create(&cachingPool.factory, "MediaEngine.sdp", 4096, 4096, NULL);
+
+    //pj_bool_t telephony = false;
+    //pjmedia_endpt_set_flag(mediaEndpoint, PJMEDIA_ENDPT_HAS_TELEPHONE_EVENT_FLAG, &telephony);
+
+    status = pjmedia_codec_g711_init(mediaEndpoint);
+    assert(status == PJ_SUCCESS);
+    status = pjmedia_codec_g722_init(mediaEndpoint);
+    assert(status == PJ_SUCCESS);
+    status = pjmedia_codec_ilbc_init(mediaEndpoint, 30);
+    assert(status == PJ_SUCCESS);
+//    status = pjmedia_codec_opus_init(mediaEndpoint);
+//    assert(status == PJ_SUCCESS);
+  }
+
+  pjmedia_sdp_session* MediaEngine::createSessionSdp(pj_pool_t* pool, int mediaCount) {
+    pj_status_t status;
+    std::lock_guard<std::mutex> lock(sdpTemplatesMutex);
+    pjmedia_sdp_session*& sdpTemplate = sdpTemplates[mediaCount];
+    if(!sdpTemplate) {
+      pj_sockaddr origin;
+      pj_str_t originString = pj_str((char*)"localhost");
+      pj_sockaddr_parse(pj_AF_INET(), 0, &originString, &origin);
+      status = pjmedia_endpt_create_base_sdp(mediaEndpoint, sdpTemplatesPool, nullptr, &origin, &sdpTemplate);
+      assert(status == PJ_SUCCESS);
+
+      /// Address is negotiated by ICE, m-lines carry the discard address
+      pjmedia_sock_info sockInfo;
+      pj_bzero(&sockInfo, sizeof(sockInfo));
+      pj_str_t zeroString = pj_str((char*)"0.0.0.0:9");
+      pj_sockaddr_parse(pj_AF_INET(), 0, &zeroString, &sockInfo.rtp_addr_name);
+      sockInfo.rtcp_addr_name = sockInfo.rtp_addr_name;
+      for(int i = 0; i < mediaCount; i++) {
+        pjmedia_sdp_media* sdpMedia;
+        status = pjmedia_endpt_create_audio_sdp(mediaEndpoint, sdpTemplatesPool, &sockInfo, 0, &sdpMedia);
+        assert(status == PJ_SUCCESS);
+        sdpTemplate->media[sdpTemplate->media_count++] = sdpMedia;
+      }
+    }
+
+    pjmedia_sdp_session* sdp = pjmedia_sdp_session_clone(pool, sdpTemplate);
+    pj_time_val now;
+    pj_gettimeofday(&now);
+    sdp->origin.id = sdp->origin.version = now.sec + 2208988800UL; // NTP time, as pjmedia does
+    return sdp;
+  }
+
+  void MediaEngine::resetSdpTemplates() {
+    std::lock_guard<std::mutex> lock(sdpTemplatesMutex);
+    sdpTemplates.clear();
+    pj_pool_reset(sdpTemplatesPool); // sessions already handed out are clones in their own pools
+  }
+
+  MediaEngine::~MediaEngine() {
+    if(sdpTemplatesPool) pj_pool_release(sdpTemplatesPool);
+    if(mediaEndpoint) pjmedia_endpt_destroy2(mediaEndpoint);
+  }
+
+}
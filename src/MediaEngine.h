@@ -0,0 +1,36 @@
+#ifndef PJWEBRTC_MEDIAENGINE_H
+#define PJWEBRTC_MEDIAENGINE_H
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "EventLoop.h"
+#include "global.h"
+
+namespace webrtc {
+
+  /// Process-wide media endpoint with codec factories registered once, shared by every PeerConnection.
+  class MediaEngine {
+  private:
+    std::mutex sdpTemplatesMutex;
+    pj_pool_t* sdpTemplatesPool;
+    std::unordered_map<int, pjmedia_sdp_session*> sdpTemplates; /* By m-line count */
+
+  public:
+    std::shared_ptr<EventLoop> eventLoop;
+    pjmedia_endpt *mediaEndpoint;
+
+    MediaEngine();
+    ~MediaEngine();
+
+    void init(std::shared_ptr<EventLoop> eventLoopp);
+
+    /// Session with mediaCount audio m-lines, cloned from a template rendered once per count, fresh origin id
+    pjmedia_sdp_session* createSessionSdp(pj_pool_t* pool, int mediaCount);
+    /// Call after codecs or their priorities change, next sessions are rendered from the endpoint again
+    void resetSdpTemplates();
+  };
+
+}
+
+#endif //PJWEBRTC_MEDIAENGINE_H
@@ -0,0 +1,263 @@
+#include "Metrics.h"
+
+namespace webrtc {
+
+  MetricsRegistry metrics;
+
+  static void appendNumber(std::string& out, double value) {
+    char buffer[32];
+    pj_ansi_snprintf(buffer, sizeof(buffer), "%.15g", value);
+    out += buffer;
+  }
+
+  static void appendSample(std::string& out, const std::string& name, const std::string& labels, double value) {
+    out += name;
+    if(!labels.empty()) {
+      out += '{';
+      out += labels;
+      out += '}';
+    }
+    out += ' ';
+    appendNumber(out, value);
+    out += '\n';
+  }
+
+  MetricsHistogram::MetricsHistogram(std::vector<unsigned long> boundsp, double scalep)
+      : bounds(std::move(boundsp)), buckets(new std::atomic<unsigned long>[bounds.size() + 1]), sum(0), scale(scalep) {
+    for(size_t i = 0; i <= bounds.size(); i++) buckets[i] = 0;
+  }
+
+  void MetricsHistogram::observe(unsigned long value) {
+    size_t i = 0;
+    while(i < bounds.size() && value > bounds[i]) i++;
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  MetricsRegistry::Metric* MetricsRegistry::add(const std::string& name, const std::string& help,
+                                                const std::string& labels, MetricType type) {
+    /// Samples of one name must be contiguous, they share a single HELP and TYPE
+    auto position = metrics.end();
+    for(auto it = metrics.begin(); it != metrics.end(); it++) {
+      if((*it)->name != name) continue;
+      position = it + 1;
+      if((*it)->labels != labels) continue;
+      /* A series is exported once, registering it again replaces what was there */
+      Metric* metric = it->get();
+      metric->help = help;
+      metric->type = type;
+      metric->counter = nullptr;
+      metric->gauge = nullptr;
+      metric->histogram = nullptr;
+      metric->read = nullptr;
+      return metric;
+    }
+    std::unique_ptr<Metric> metric(new Metric());
+    metric->name = name;
+    metric->help = help;
+    metric->labels = labels;
+    metric->type = type;
+    metric->counter = nullptr;
+    metric->gauge = nullptr;
+    metric->histogram = nullptr;
+    return metrics.insert(position, std::move(metric))->get();
+  }
+
+  MetricsCounter* MetricsRegistry::counter(const std::string& name, const std::string& help,
+                                           const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& metric : metrics) {
+      if(metric->counter && metric->name == name && metric->labels == labels) return metric->counter;
+    }
+    counters.emplace_back(new MetricsCounter());
+    add(name, help, labels, MetricType::Counter)->counter = counters.back().get();
+    return counters.back().get();
+  }
+
+  MetricsGauge* MetricsRegistry::gauge(const std::string& name, const std::string& help,
+                                       const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& metric : metrics) {
+      if(metric->gauge && metric->name == name && metric->labels == labels) return metric->gauge;
+    }
+    gauges.emplace_back(new MetricsGauge());
+    add(name, help, labels, MetricType::Gauge)->gauge = gauges.back().get();
+    return gauges.back().get();
+  }
+
+  MetricsHistogram* MetricsRegistry::histogram(const std::string& name, const std::string& help,
+                                               std::vector<unsigned long> bounds, double scale) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& metric : metrics) {
+      if(metric->histogram && metric->name == name) return metric->histogram;
+    }
+    histograms.emplace_back(new MetricsHistogram(std::move(bounds), scale));
+    add(name, help, "", MetricType::Histogram)->histogram = histograms.back().get();
+    return histograms.back().get();
+  }
+
+  void MetricsRegistry::counterFunction(const std::string& name, const std::string& help,
+                                        std::function<double()> read, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    add(name, help, labels, MetricType::Counter)->read = std::move(read);
+  }
+
+  void MetricsRegistry::gaugeFunction(const std::string& name, const std::string& help,
+                                      std::function<double()> read, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    add(name, help, labels, MetricType::Gauge)->read = std::move(read);
+  }
+
+  void MetricsRegistry::removeFunction(const std::string& name, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto it = metrics.begin(); it != metrics.end(); it++) {
+      if(!(*it)->read || (*it)->name != name || (*it)->labels != labels) continue;
+      metrics.erase(it);
+      return;
+    }
+  }
+
+  std::string MetricsRegistry::render() {
+    std::string out;
+    std::lock_guard<std::mutex> lock(mutex);
+    out.reserve(metrics.size() * 128);
+    const std::string* previousName = nullptr;
+    for(auto& metric : metrics) {
+      if(!previousName || *previousName != metric->name) {
+        out += "# HELP " + metric->name + " " + metric->help + "\n";
+        out += "# TYPE " + metric->name;
+        out += metric->type == MetricType::Counter ? " counter\n"
+                                                   : metric->type == MetricType::Gauge ? " gauge\n" : " histogram\n";
+        previousName = &metric->name;
+      }
+      if(metric->read) {
+        appendSample(out, metric->name, metric->labels, metric->read());
+      } else if(metric->counter) {
+        appendSample(out, metric->name, metric->labels, metric->counter->value.load(std::memory_order_relaxed));
+      } else if(metric->gauge) {
+        appendSample(out, metric->name, metric->labels, metric->gauge->value.load(std::memory_order_relaxed));
+      } else if(metric->histogram) {
+        MetricsHistogram* histogram = metric->histogram;
+        unsigned long cumulative = 0;
+        for(size_t i = 0; i <= histogram->bounds.size(); i++) {
+          cumulative += histogram->buckets[i].load(std::memory_order_relaxed);
+          std::string le = "le=\"";
+          if(i < histogram->bounds.size()) appendNumber(le, histogram->bounds[i] * histogram->scale);
+          else le += "+Inf";
+          le += "\"";
+          appendSample(out, metric->name + "_bucket", le, cumulative);
+        }
+        appendSample(out, metric->name + "_sum", "", histogram->sum.load(std::memory_order_relaxed) * histogram->scale);
+        appendSample(out, metric->name + "_count", "", cumulative);
+      }
+    }
+    return out;
+  }
+
+  int metricsServerThread(void* arg) {
+    MetricsServer* server = (MetricsServer*)arg;
+    while(server->running) {
+      /* Short select instead of a blocking accept, so stop() doesn't wait for a scrape */
+      pj_fd_set_t readSet;
+      PJ_FD_ZERO(&readSet);
+      PJ_FD_SET(server->listenSocket, &readSet);
+      pj_time_val timeout = {0, 200};
+      if(pj_sock_select(server->listenSocket + 1, &readSet, NULL, NULL, &timeout) <= 0) continue;
+      pj_sock_t sock;
+      if(pj_sock_accept(server->listenSocket, &sock, NULL, NULL) != PJ_SUCCESS) continue;
+      server->handleConnection(sock);
+      pj_sock_close(sock);
+    }
+    return 0;
+  }
+
+  MetricsServer::MetricsServer() {
+    pool = nullptr;
+    listenSocket = PJ_INVALID_SOCKET;
+    thread = nullptr;
+    running = false;
+    registry = nullptr;
+  }
+
+  void MetricsServer::init(MetricsServerConfiguration& configurationp, MetricsRegistry* registryp) {
+    configuration = configurationp;
+    registry = registryp;
+
+    pj_status_t status;
+    pool = pj_pool_create(&cachingPool.factory, "MetricsServer.pool", 1024, 1024, NULL);
+
+    pj_str_t bindAddressString = pj_str((char*)configuration.bindAddress.c_str());
+    int af = configuration.bindAddress.find(':') == std::string::npos ? pj_AF_INET() : pj_AF_INET6();
+    pj_sockaddr bindAddress;
+    status = pj_sockaddr_init(af, &bindAddress, &bindAddressString, configuration.port);
+    assert(status == PJ_SUCCESS);
+
+    status = pj_sock_socket(af, pj_SOCK_STREAM(), 0, &listenSocket);
+    assert(status == PJ_SUCCESS);
+    int on = 1;
+    pj_sock_setsockopt(listenSocket, pj_SOL_SOCKET(), pj_SO_REUSEADDR(), &on, sizeof(on));
+    status = pj_sock_bind(listenSocket, &bindAddress, pj_sockaddr_get_len(&bindAddress));
+    assert(status == PJ_SUCCESS);
+    status = pj_sock_listen(listenSocket, 16);
+    assert(status == PJ_SUCCESS);
+
+    running = true;
+    status = pj_thread_create(pool, "metrics", &metricsServerThread, (void*)this,
+                              PJ_THREAD_DEFAULT_STACK_SIZE, 0, &thread);
+    assert(status == PJ_SUCCESS);
+  }
+
+  void MetricsServer::handleConnection(pj_sock_t sock) {
+    char request[2048];
+    pj_ssize_t received = 0;
+    while(received < (pj_ssize_t)sizeof(request) - 1) {
+      pj_fd_set_t readSet;
+      PJ_FD_ZERO(&readSet);
+      PJ_FD_SET(sock, &readSet);
+      pj_time_val timeout = {1, 0};
+      if(pj_sock_select(sock + 1, &readSet, NULL, NULL, &timeout) <= 0) return;
+      pj_ssize_t size = sizeof(request) - 1 - received;
+      if(pj_sock_recv(sock, request + received, &size, 0) != PJ_SUCCESS || size <= 0) return;
+      received += size;
+      request[received] = 0;
+      if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[received] = 0;
+
+    std::string body;
+    const char* statusLine;
+    if(strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0) {
+      statusLine = "HTTP/1.1 200 OK\r\n";
+      body = registry->render();
+    } else {
+      statusLine = "HTTP/1.1 404 Not Found\r\n";
+      body = "not found\n";
+    }
+    std::string response = statusLine;
+    response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+
+    pj_ssize_t sent = 0;
+    while(sent < (pj_ssize_t)response.size()) {
+      pj_ssize_t size = response.size() - sent;
+      if(pj_sock_send(sock, response.data() + sent, &size, 0) != PJ_SUCCESS || size <= 0) return;
+      sent += size;
+    }
+  }
+
+  void MetricsServer::stop() {
+    if(!running) return;
+    running = false;
+    pj_thread_join(thread);
+    pj_thread_destroy(thread);
+    pj_sock_close(listenSocket);
+  }
+
+  MetricsServer::~MetricsServer() {
+    stop();
+    if(pool) pj_pool_release(pool);
+  }
+
+}
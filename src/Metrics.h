@@ -0,0 +1,119 @@
+#ifndef PJWEBRTC_METRICS_H
+#define PJWEBRTC_METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "global.h"
+
+namespace webrtc {
+
+  class MetricsCounter {
+  public:
+    std::atomic<unsigned long> value;
+
+    MetricsCounter() : value(0) {}
+    void add(unsigned long n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  };
+
+  class MetricsGauge {
+  public:
+    std::atomic<long> value;
+
+    MetricsGauge() : value(0) {}
+    void add(long n) { value.fetch_add(n, std::memory_order_relaxed); }
+    void set(long n) { value.store(n, std::memory_order_relaxed); }
+  };
+
+  /// Fixed buckets of relaxed atomic counts. Values are observed in integer units (usec mostly) and
+  /// multiplied by scale when exported, so le bounds and sum come out in seconds.
+  class MetricsHistogram {
+  public:
+    std::vector<unsigned long> bounds;
+    std::unique_ptr<std::atomic<unsigned long>[]> buckets; /* bounds.size() + 1, last one is +Inf */
+    std::atomic<unsigned long> sum;
+    double scale;
+
+    MetricsHistogram(std::vector<unsigned long> boundsp, double scalep);
+    void observe(unsigned long value);
+  };
+
+  /// Process-wide metrics in Prometheus text format. Metrics are registered once and updated in place
+  /// by their owners, a scrape walks the fixed list and never touches individual connections.
+  class MetricsRegistry {
+  private:
+    enum class MetricType { Counter, Gauge, Histogram };
+
+    struct Metric {
+      std::string name;
+      std::string help;
+      std::string labels; /* rendered form, name="value",... */
+      MetricType type;
+      MetricsCounter* counter;
+      MetricsGauge* gauge;
+      MetricsHistogram* histogram;
+      std::function<double()> read; /* counters and gauges kept somewhere else */
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Metric>> metrics;
+    std::vector<std::unique_ptr<MetricsCounter>> counters;
+    std::vector<std::unique_ptr<MetricsGauge>> gauges;
+    std::vector<std::unique_ptr<MetricsHistogram>> histograms;
+
+    Metric* add(const std::string& name, const std::string& help, const std::string& labels, MetricType type);
+
+  public:
+    /// Same name and labels return the same object, pointers stay valid for the process lifetime.
+    /// Any other registration of an existing name and labels replaces the series.
+    MetricsCounter* counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricsGauge* gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricsHistogram* histogram(const std::string& name, const std::string& help,
+                                std::vector<unsigned long> bounds, double scale);
+    /// Exported as read() at scrape time, for counters other classes already keep
+    void counterFunction(const std::string& name, const std::string& help, std::function<double()> read,
+                         const std::string& labels = "");
+    void gaugeFunction(const std::string& name, const std::string& help, std::function<double()> read,
+                       const std::string& labels = "");
+    /// Unregisters a counterFunction or gaugeFunction, read() is not running and won't be called once this returns
+    void removeFunction(const std::string& name, const std::string& labels = "");
+
+    std::string render();
+  };
+
+  extern MetricsRegistry metrics;
+
+  struct MetricsServerConfiguration {
+    std::string bindAddress = "127.0.0.1";
+    int port = 9464;
+  };
+
+  /// Answers GET /metrics on a plain TCP socket from its own thread, one request per connection
+  class MetricsServer {
+  private:
+    pj_pool_t* pool;
+    pj_sock_t listenSocket;
+    pj_thread_t* thread;
+    std::atomic<bool> running;
+
+    void handleConnection(pj_sock_t sock);
+
+    friend int metricsServerThread(void* arg);
+
+  public:
+    MetricsServerConfiguration configuration;
+    MetricsRegistry* registry;
+
+    MetricsServer();
+    ~MetricsServer();
+
+    void init(MetricsServerConfiguration& configurationp, MetricsRegistry* registryp = &metrics);
+    void stop();
+  };
+
+}
+
+#endif //PJWEBRTC_METRICS_H
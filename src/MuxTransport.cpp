@@ -0,0 +1,301 @@
+#include "MuxTransport.h"
+#include <pjnath.h>
+
+namespace webrtc {
+
+  static const int MAX_PENDING_PACKETS = 16;
+  static const pj_uint32_t HOST_CANDIDATE_PRIORITY = (126 << 24) | (65535 << 8) | 255;
+
+  pj_status_t muxGetInfo(pjmedia_transport *tp, pjmedia_transport_info *info) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    info->sock_info.rtp_sock = PJ_INVALID_SOCKET;
+    info->sock_info.rtcp_sock = PJ_INVALID_SOCKET;
+    info->sock_info.rtp_addr_name = transport->mux->publicAddress;
+    info->sock_info.rtcp_addr_name = transport->mux->publicAddress;
+    std::lock_guard<std::mutex> lock(transport->mutex);
+    if(transport->hasRemoteAddress) {
+      info->src_rtp_name = transport->remoteAddress;
+      info->src_rtcp_name = transport->remoteAddress;
+    }
+    return PJ_SUCCESS;
+  }
+
+  pj_status_t muxAttach2(pjmedia_transport *tp, pjmedia_transport_attach_param *attachParam) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    std::lock_guard<std::mutex> lock(transport->mutex);
+    transport->attachParam = *attachParam;
+    transport->attached = true;
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t muxAttach(pjmedia_transport *tp, void *user_data,
+                               const pj_sockaddr_t *rem_addr, const pj_sockaddr_t *rem_rtcp, unsigned addr_len,
+                               void (*rtp_cb)(void*, void*, pj_ssize_t),
+                               void (*rtcp_cb)(void*, void*, pj_ssize_t)) {
+    pjmedia_transport_attach_param attachParam;
+    pj_bzero(&attachParam, sizeof(attachParam));
+    attachParam.user_data = user_data;
+    attachParam.rtp_cb = rtp_cb;
+    attachParam.rtcp_cb = rtcp_cb;
+    return muxAttach2(tp, &attachParam);
+  }
+
+  void muxDetach(pjmedia_transport *tp, void *user_data) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    std::lock_guard<std::mutex> lock(transport->mutex);
+    transport->attached = false;
+  }
+
+  pj_status_t muxSend(pjmedia_transport *tp, const void *pkt, pj_size_t size) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    std::unique_lock<std::mutex> lock(transport->mutex);
+    if(!transport->hasRemoteAddress) {
+      if(transport->pendingPackets.size() < MAX_PENDING_PACKETS)
+        transport->pendingPackets.emplace_back((const char*)pkt, size);
+      return PJ_SUCCESS;
+    }
+    pj_sockaddr address = transport->remoteAddress;
+    int socketIndex = transport->socketIndex;
+    lock.unlock();
+    /// One syscall per packet, streams hand over one frame per ptime and holding RTP back to batch it adds delay
+    return transport->mux->send(socketIndex, &address, pkt, size);
+  }
+
+  static pj_status_t muxSendRtcp2(pjmedia_transport *tp, const pj_sockaddr_t *addr, unsigned addr_len,
+                                  const void *pkt, pj_size_t size) {
+    return muxSend(tp, pkt, size); // rtcp is always muxed with rtp
+  }
+
+  static pj_status_t muxMediaCreate(pjmedia_transport *tp, pj_pool_t *sdp_pool, unsigned options,
+                                    const pjmedia_sdp_session *remote_sdp, unsigned media_index) {
+    return PJ_SUCCESS;
+  }
+
+  static void addAttribute(pj_pool_t* pool, pjmedia_sdp_media* media, const char* name, const std::string& value) {
+    pj_str_t valueString = pj_strdup3(pool, value.c_str());
+    pjmedia_sdp_media_add_attr(media, pjmedia_sdp_attr_create(pool, name, &valueString));
+  }
+
+  pj_status_t muxEncodeSdp(pjmedia_transport *tp, pj_pool_t *sdp_pool, pjmedia_sdp_session *sdp_local,
+                           const pjmedia_sdp_session *rem_sdp, unsigned media_index) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    pjmedia_sdp_media* media = sdp_local->media[media_index];
+
+    char address[PJ_INET6_ADDRSTRLEN];
+    pj_sockaddr_print(&transport->mux->publicAddress, address, sizeof(address), 0);
+    std::string candidate = "1 1 UDP " + std::to_string(HOST_CANDIDATE_PRIORITY) + " " + address + " "
+        + std::to_string(pj_sockaddr_get_port(&transport->mux->publicAddress)) + " typ host";
+
+    addAttribute(sdp_pool, media, "ice-ufrag", transport->localUfrag);
+    addAttribute(sdp_pool, media, "ice-pwd", transport->localPwd);
+    addAttribute(sdp_pool, media, "candidate", candidate);
+    if(!pjmedia_sdp_media_find_attr2(media, "rtcp-mux", nullptr))
+      pjmedia_sdp_media_add_attr(media, pjmedia_sdp_attr_create(sdp_pool, "rtcp-mux", nullptr));
+    if(!pjmedia_sdp_attr_find2(sdp_local->attr_count, sdp_local->attr, "ice-lite", nullptr))
+      pjmedia_sdp_attr_add(&sdp_local->attr_count, sdp_local->attr,
+                           pjmedia_sdp_attr_create(sdp_pool, "ice-lite", nullptr));
+    return PJ_SUCCESS;
+  }
+
+  pj_status_t muxMediaStart(pjmedia_transport *tp, pj_pool_t *tmp_pool,
+                            const pjmedia_sdp_session *sdp_local, const pjmedia_sdp_session *sdp_remote,
+                            unsigned media_index) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    const pjmedia_sdp_media* media = sdp_remote->media[media_index];
+    pjmedia_sdp_attr* ufrag = pjmedia_sdp_media_find_attr2(media, "ice-ufrag", nullptr);
+    if(!ufrag) ufrag = pjmedia_sdp_attr_find2(sdp_remote->attr_count, sdp_remote->attr, "ice-ufrag", nullptr);
+    if(!ufrag) return PJ_EINVAL;
+    std::lock_guard<std::mutex> lock(transport->mutex);
+    transport->remoteUfrag = std::string(ufrag->value.ptr, ufrag->value.slen);
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t muxMediaStop(pjmedia_transport *tp) {
+    return PJ_SUCCESS;
+  }
+
+  static pj_status_t muxSimulateLost(pjmedia_transport *tp, pjmedia_dir dir, unsigned pct_lost) {
+    return PJ_ENOTSUP;
+  }
+
+  pj_status_t muxDestroy(pjmedia_transport *tp) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    pj_sockaddr boundAddress;
+    bool bound;
+    {
+      std::lock_guard<std::mutex> lock(transport->mutex);
+      transport->attached = false;
+      transport->closed = true; // latched address can't move anymore, the copy stays right
+      bound = transport->hasRemoteAddress;
+      if(bound) boundAddress = transport->remoteAddress;
+    }
+    /// Mux tables hold the last references, transport is gone once in-flight packets are delivered
+    transport->mux->unregisterTransport(transport, bound ? &boundAddress : nullptr);
+    return PJ_SUCCESS;
+  }
+
+  static pjmedia_transport_op muxOps = {
+      &muxGetInfo,
+      &muxAttach,
+      &muxDetach,
+      &muxSend,
+      &muxSend,
+      &muxSendRtcp2,
+      &muxMediaCreate,
+      &muxEncodeSdp,
+      &muxMediaStart,
+      &muxMediaStop,
+      &muxSimulateLost,
+      &muxDestroy,
+      &muxAttach2
+  };
+
+  static std::string randomIceString(int length) {
+    std::string value(length, '\0');
+    pj_create_random_string(&value[0], length);
+    return value;
+  }
+
+  MuxTransport::MuxTransport(std::shared_ptr<UdpMux> muxp) {
+    mux = muxp;
+    stunPool = pj_pool_create(&cachingPool.factory, "MuxTransport.stun", 1024, 1024, NULL);
+    hasRemoteAddress = false;
+    socketIndex = 0;
+    attached = false;
+    closed = false;
+    pj_bzero(&attachParam, sizeof(attachParam));
+    localUfrag = randomIceString(8);
+    localPwd = randomIceString(24);
+
+    pj_bzero(&handle, sizeof(handle));
+    pj_ansi_strncpy(handle.base.name, "muxtp", PJ_MAX_OBJ_NAME);
+    handle.base.type = PJMEDIA_TRANSPORT_TYPE_USER;
+    handle.base.op = &muxOps;
+    handle.owner = this;
+  }
+
+  MuxTransport::~MuxTransport() {
+    pj_pool_release(stunPool);
+  }
+
+  pjmedia_transport* MuxTransport::create(std::shared_ptr<UdpMux> mux, void* userData) {
+    auto transport = std::make_shared<MuxTransport>(mux);
+    transport->handle.base.user_data = userData;
+    mux->registerTransport(transport->localUfrag, transport);
+    return &transport->handle.base;
+  }
+
+  bool MuxTransport::isMuxTransport(pjmedia_transport* tp) {
+    return tp->op == &muxOps;
+  }
+
+  void MuxTransport::getCandidate(pjmedia_transport* tp, pj_pool_t* pool, pj_ice_sess_cand* cand) {
+    MuxTransport* transport = ((MuxTransportHandle*)tp)->owner;
+    pj_bzero(cand, sizeof(pj_ice_sess_cand));
+    cand->type = PJ_ICE_CAND_TYPE_HOST;
+    cand->comp_id = 1;
+    cand->prio = HOST_CANDIDATE_PRIORITY;
+    cand->foundation = pj_strdup3(pool, "1");
+    cand->addr = transport->mux->publicAddress;
+    cand->base_addr = transport->mux->publicAddress;
+  }
+
+  void MuxTransport::handlePacket(int socketIndexp, pj_uint8_t* packet, pj_ssize_t size,
+                                  const pj_sockaddr* source, bool stun) {
+    if(stun) handleStun(socketIndexp, packet, size, source);
+    else deliver(packet, size, source);
+  }
+
+  void MuxTransport::handleStun(int socketIndexp, pj_uint8_t* packet, pj_ssize_t size, const pj_sockaddr* source) {
+    std::unique_lock<std::mutex> lock(mutex);
+    pj_status_t status;
+    pj_stun_msg* request;
+    pj_size_t parsedLength;
+    status = pj_stun_msg_decode(stunPool, packet, size, PJ_STUN_IS_DATAGRAM | PJ_STUN_CHECK_PACKET,
+                                &request, &parsedLength, nullptr);
+    if(status != PJ_SUCCESS || request->hdr.type != PJ_STUN_BINDING_REQUEST) {
+      pj_pool_reset(stunPool);
+      return; // lite agent never sends checks, so there is nothing else to handle
+    }
+
+    pj_stun_username_attr* username =
+        (pj_stun_username_attr*)pj_stun_msg_find_attr(request, PJ_STUN_ATTR_USERNAME, 0);
+    std::string expectedUsername = localUfrag + ":" + remoteUfrag;
+    if(!username || remoteUfrag.empty() || pj_strcmp2(&username->value, expectedUsername.c_str()) != 0) {
+      pj_pool_reset(stunPool);
+      return;
+    }
+
+    pj_stun_auth_cred credential;
+    pj_bzero(&credential, sizeof(credential));
+    credential.type = PJ_STUN_AUTH_CRED_STATIC;
+    credential.data.static_cred.username = username->value;
+    credential.data.static_cred.data_type = PJ_STUN_PASSWD_PLAIN;
+    credential.data.static_cred.data = pj_str((char*)localPwd.c_str());
+    pj_stun_req_cred_info credentialInfo;
+    status = pj_stun_authenticate_request(packet, size, request, &credential, stunPool, &credentialInfo, nullptr);
+    if(status != PJ_SUCCESS) {
+      pj_pool_reset(stunPool);
+      return;
+    }
+
+    pj_stun_msg* response;
+    pj_stun_msg_create_response(stunPool, request, 0, nullptr, &response);
+    pj_stun_msg_add_sockaddr_attr(stunPool, response, PJ_STUN_ATTR_XOR_MAPPED_ADDR, PJ_TRUE,
+                                  source, pj_sockaddr_get_len(source));
+    pj_stun_msg_add_msgint_attr(stunPool, response);
+    pj_stun_msg_add_uint_attr(stunPool, response, PJ_STUN_ATTR_FINGERPRINT, 0);
+    pj_uint8_t buffer[512];
+    pj_size_t responseLength;
+    pj_str_t key = pj_str((char*)localPwd.c_str());
+    status = pj_stun_msg_encode(response, buffer, sizeof(buffer), 0, &key, &responseLength);
+
+    bool nominated = pj_stun_msg_find_attr(request, PJ_STUN_ATTR_USE_CANDIDATE, 0) != nullptr;
+    bool latch = !closed && (nominated || !hasRemoteAddress);
+    pj_pool_reset(stunPool);
+
+    std::vector<std::string> packets;
+    if(status == PJ_SUCCESS) packets.emplace_back((const char*)buffer, responseLength);
+    if(latch) {
+      /// Controlling agent decides, we follow its nomination or the first authenticated address.
+      /// Nominated checks repeat as keepalives, the mux tables change only when the address does.
+      if(!hasRemoteAddress || !(AddressKey(&remoteAddress) == AddressKey(source))) {
+        mux->bindAddress(source, hasRemoteAddress ? &remoteAddress : nullptr, shared_from_this());
+      }
+      remoteAddress = *source;
+      socketIndex = socketIndexp;
+      hasRemoteAddress = true;
+      for(auto& pending : pendingPackets) packets.push_back(std::move(pending));
+      pendingPackets.clear();
+    }
+    lock.unlock();
+
+    /// Response and everything queued before the address was known leave in one syscall
+    mux->sendBatch(socketIndexp, source, packets);
+  }
+
+  void MuxTransport::deliver(pj_uint8_t* packet, pj_ssize_t size, const pj_sockaddr* source) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!attached || size < 2) return;
+    pjmedia_transport_attach_param param = attachParam;
+    lock.unlock();
+
+    /// RTCP is muxed on the RTP port, DTLS records go up the RTP path where SRTP picks them out
+    bool rtcp = (packet[0] & 0xC0) == 0x80 && packet[1] >= 192 && packet[1] <= 223;
+    if(rtcp) {
+      if(param.rtcp_cb) param.rtcp_cb(param.user_data, packet, size);
+    } else if(param.rtp_cb2) {
+      pjmedia_tp_cb_param cbParam;
+      pj_bzero(&cbParam, sizeof(cbParam));
+      cbParam.user_data = param.user_data;
+      cbParam.pkt = packet;
+      cbParam.size = size;
+      cbParam.src_addr = (pj_sockaddr*)source;
+      cbParam.rem_switch = PJ_FALSE;
+      param.rtp_cb2(&cbParam);
+    } else if(param.rtp_cb) {
+      param.rtp_cb(param.user_data, packet, size);
+    }
+  }
+
+}
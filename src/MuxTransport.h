@@ -0,0 +1,74 @@
+#ifndef PJWEBRTC_MUXTRANSPORT_H
+#define PJWEBRTC_MUXTRANSPORT_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "UdpMux.h"
+#include "global.h"
+
+namespace webrtc {
+
+  class MuxTransport;
+
+  struct MuxTransportHandle {
+    pjmedia_transport base;
+    MuxTransport* owner;
+  };
+
+  /// ICE-lite media transport on a shared UdpMux port: answers connectivity checks and latches the nominated address.
+  class MuxTransport : public std::enable_shared_from_this<MuxTransport> {
+  private:
+    std::mutex mutex;
+    pj_pool_t* stunPool;
+
+    bool hasRemoteAddress;
+    pj_sockaddr remoteAddress; /* latched, the one address the mux routes to this transport */
+    int socketIndex;
+    bool closed; /* unregistered from the mux, checks no longer latch */
+
+    bool attached;
+    pjmedia_transport_attach_param attachParam;
+
+    /* Sent before the first check arrived, DTLS client hello mostly */
+    std::deque<std::string> pendingPackets;
+
+    void handleStun(int socketIndexp, pj_uint8_t* packet, pj_ssize_t size, const pj_sockaddr* source);
+    void deliver(pj_uint8_t* packet, pj_ssize_t size, const pj_sockaddr* source);
+
+    friend pj_status_t muxGetInfo(pjmedia_transport *tp, pjmedia_transport_info *info);
+    friend pj_status_t muxAttach2(pjmedia_transport *tp, pjmedia_transport_attach_param *attachParam);
+    friend void muxDetach(pjmedia_transport *tp, void *user_data);
+    friend pj_status_t muxSend(pjmedia_transport *tp, const void *pkt, pj_size_t size);
+    friend pj_status_t muxEncodeSdp(pjmedia_transport *tp, pj_pool_t *sdp_pool, pjmedia_sdp_session *sdp_local,
+                                    const pjmedia_sdp_session *rem_sdp, unsigned media_index);
+    friend pj_status_t muxMediaStart(pjmedia_transport *tp, pj_pool_t *tmp_pool,
+                                     const pjmedia_sdp_session *sdp_local, const pjmedia_sdp_session *sdp_remote,
+                                     unsigned media_index);
+    friend pj_status_t muxDestroy(pjmedia_transport *tp);
+
+  public:
+    MuxTransportHandle handle;
+    std::shared_ptr<UdpMux> mux;
+
+    std::string localUfrag;
+    std::string localPwd;
+    std::string remoteUfrag;
+
+    MuxTransport(std::shared_ptr<UdpMux> muxp);
+    ~MuxTransport();
+
+    /// Creates the transport and registers its ufrag in the mux, pjmedia_transport_close releases it
+    static pjmedia_transport* create(std::shared_ptr<UdpMux> mux, void* userData);
+    static bool isMuxTransport(pjmedia_transport* tp);
+    /// The single host candidate, the mux public address
+    static void getCandidate(pjmedia_transport* tp, pj_pool_t* pool, pj_ice_sess_cand* cand);
+
+    void handlePacket(int socketIndexp, pj_uint8_t* packet, pj_ssize_t size, const pj_sockaddr* source, bool stun);
+  };
+
+}
+
+#endif //PJWEBRTC_MUXTRANSPORT_H
@@ -7,33 +7,156 @@
 
 namespace webrtc {
 
+  /* Transport callbacks come with ICE and SRTP locks held, the connection is only entered from its strand */
+
   void onIceComplete(pjmedia_transport *tp, pj_ice_strans_op op, pj_status_t status){
-    assert(status == PJ_SUCCESS);
     PeerConnection* pc = (PeerConnection*)tp->user_data;
-    pc->handleIceTransportComplete(tp);
+    if(op == PJ_ICE_STRANS_OP_NEGOTIATION) {
+      pc->strand->execute([pc, tp, status]() { pc->handleIceNegotiationComplete(tp, status); });
+      return;
+    }
+    assert(status == PJ_SUCCESS);
+    if(op != PJ_ICE_STRANS_OP_INIT) return;
+    pc->strand->execute([pc, tp]() { pc->handleIceTransportComplete(tp); });
   }
 
   void onIceComplete2(pjmedia_transport *tp, pj_ice_strans_op op, pj_status_t status, void *user_data){
-    assert(status == PJ_SUCCESS);
+    onIceComplete(tp, op, status);
+  }
+
+  void onIceNewCandidate(pjmedia_transport *tp, const pj_ice_sess_cand *cand, pj_bool_t last) {
+    /* last only ends this transport, gathering is complete when handleIceTransportComplete counted them all */
+    if(!cand) return;
     PeerConnection* pc = (PeerConnection*)tp->user_data;
-    pc->handleIceTransportComplete(tp);
+    /* cand belongs to pjnath, it is copied before the callback returns */
+    IceCandidate candidate(cand);
+    pc->strand->execute([pc, tp, candidate]() { pc->handleIceNewCandidate(tp, candidate); });
   }
 
   pjmedia_ice_cb iceCallbacks = {
     .on_ice_complete = onIceComplete,
-    .on_ice_complete2 = onIceComplete2
+    .on_ice_complete2 = onIceComplete2,
+    .on_new_candidate = onIceNewCandidate
   };
 
   void onSrtpComplete(pjmedia_transport *tp, pj_status_t status) {
     assert(status == PJ_SUCCESS);
     PeerConnection* pc = (PeerConnection*)tp->user_data;
-    pc->handleDtlsTransportComplete(tp);
+    pc->strand->execute([pc, tp]() { pc->handleDtlsTransportComplete(tp); });
   }
 
   pjmedia_srtp_cb srtpCallbacks = {
       .on_srtp_nego_complete = onSrtpComplete
   };
 
+  void statsWheelCb(TimingWheelEntry* entry);
+  void gatheringWheelCb(TimingWheelEntry* entry);
+
+  std::atomic<unsigned long> PeerConnection::iceGatheringDeadlineHits(0);
+  std::atomic<unsigned long> PeerConnection::lastId(0);
+
+  static const char* connectionStates[] = {"new", "connecting", "connected", "disconnected", "failed", "closed"};
+  static const char* iceConnectionStates[] = {"new", "checking", "connected", "completed", "disconnected", "failed",
+                                              "closed"};
+  static const char* dtlsStates[] = {"new", "connecting", "connected", "failed", "closed"};
+
+  /// Process totals in the metrics registry, connections add to them instead of being walked on scrape
+  struct PeerConnectionMetrics {
+    MetricsGauge* connections;
+    std::vector<std::pair<std::string, MetricsGauge*>> connectionStates;
+    std::vector<std::pair<std::string, MetricsGauge*>> iceConnectionStates;
+    std::vector<std::pair<std::string, MetricsGauge*>> dtlsStates;
+
+    MetricsCounter* packetsReceived;
+    MetricsCounter* bytesReceived;
+    MetricsCounter* packetsLost;
+    MetricsCounter* packetsSent;
+    MetricsCounter* bytesSent;
+    MetricsHistogram* jitter;
+    MetricsHistogram* roundTripTime;
+    MetricsHistogram* lossPeriod;
+
+    /// Usec of each setup stage over every connection, indexed by SetupStage
+    HdrHistogram setupStages[(int)SetupStage::Count];
+
+    template<size_t N> void registerStates(std::vector<std::pair<std::string, MetricsGauge*>>& gauges,
+                                           const char* (&names)[N], const char* name, const char* help) {
+      for(auto state : names) {
+        gauges.emplace_back(state, metrics.gauge(name, help, std::string("state=\"") + state + "\""));
+      }
+    }
+
+    PeerConnectionMetrics() {
+      connections = metrics.gauge("pjwebrtc_peer_connections", "PeerConnection objects alive");
+      registerStates(connectionStates, webrtc::connectionStates,
+                     "pjwebrtc_peer_connection_state", "PeerConnections per connectionState");
+      registerStates(iceConnectionStates, webrtc::iceConnectionStates,
+                     "pjwebrtc_ice_connection_state", "PeerConnections per iceConnectionState");
+      registerStates(dtlsStates, webrtc::dtlsStates,
+                     "pjwebrtc_dtls_state", "PeerConnections per DTLS transport state");
+
+      packetsReceived = metrics.counter("pjwebrtc_rtp_packets_received_total", "RTP packets received");
+      bytesReceived = metrics.counter("pjwebrtc_rtp_bytes_received_total", "RTP payload bytes received");
+      packetsLost = metrics.counter("pjwebrtc_rtp_packets_lost_total", "RTP packets lost on receive");
+      packetsSent = metrics.counter("pjwebrtc_rtp_packets_sent_total", "RTP packets sent");
+      bytesSent = metrics.counter("pjwebrtc_rtp_bytes_sent_total", "RTP payload bytes sent");
+
+      jitter = metrics.histogram("pjwebrtc_rtp_jitter_seconds",
+                                 "Receive jitter, sampled per stream on every stats read",
+                                 {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000}, 1e-6);
+      roundTripTime = metrics.histogram("pjwebrtc_rtt_seconds",
+                                        "RTCP round trip time, sampled per stream on every stats read",
+                                        {10000, 25000, 50000, 100000, 200000, 300000, 500000, 1000000, 2000000}, 1e-6);
+      lossPeriod = metrics.histogram("pjwebrtc_rtp_loss_period_seconds", "Length of receive loss periods",
+                                     {20000, 40000, 100000, 200000, 500000, 1000000, 2000000, 5000000}, 1e-6);
+
+      metrics.counterFunction("pjwebrtc_ice_gathering_deadline_hits_total",
+                              "Gathering promises resolved by iceGatheringDeadlineMsec",
+                              []() { return (double)PeerConnection::iceGatheringDeadlineHits.load(); });
+    }
+
+    static void move(std::vector<std::pair<std::string, MetricsGauge*>>& gauges,
+                     const std::string& from, const std::string& to) {
+      for(auto& gauge : gauges) {
+        if(gauge.first == from) gauge.second->add(-1);
+        if(gauge.first == to) gauge.second->add(1);
+      }
+    }
+  };
+
+  static PeerConnectionMetrics& peerConnectionMetrics() {
+    static PeerConnectionMetrics instance;
+    return instance;
+  }
+
+  /// Lite connections without configuration.udpMux share one port per event loop, created by the first of them
+  /// with its iceLiteMux and closed when the last one is gone
+  static std::shared_ptr<UdpMux> liteMux(EventLoop* eventLoop, UdpMuxConfiguration& configuration) {
+    static std::mutex mutex;
+    static std::unordered_map<EventLoop*, std::weak_ptr<UdpMux>> muxes;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<UdpMux> mux = muxes[eventLoop].lock();
+    if(mux) return mux;
+    mux = std::make_shared<UdpMux>();
+    mux->init(configuration);
+    muxes[eventLoop] = mux;
+    return mux;
+  }
+
+  /* Stores the new total and adds its growth to the process counter */
+  template<typename T> static void publishTotal(std::atomic<T>& local, T total, MetricsCounter* process) {
+    T previous = local.exchange(total, std::memory_order_relaxed);
+    if(total > previous) process->add(total - previous);
+  }
+
+  static pj_str_t findIceAttribute(pjmedia_sdp_session* sdp, int mediaIndex, const char* name) {
+    pjmedia_sdp_media* media = sdp->media[mediaIndex];
+    pjmedia_sdp_attr* attr = pjmedia_sdp_attr_find2(media->attr_count, media->attr, name, nullptr);
+    if(!attr) attr = pjmedia_sdp_attr_find2(sdp->attr_count, sdp->attr, name, nullptr);
+    if(!attr) return pj_str((char*)"");
+    return attr->value;
+  }
+
   void PeerConnection::addIceServer(std::string& url, std::string username, std::string password) {
     std::string protocol = url.substr(0, 4);
     std::string hostPart = url.substr(5, url.size()-5);
@@ -84,6 +207,9 @@ namespace webrtc {
     iceGatheringState = "new";
     iceConnectionState = "new";
     connectionState = "new";
+    dtlsState = "new";
+    mediaTransportsIceNegotiatedCount = 0;
+    id = ++lastId;
     signalingState = "stable";
 
     remoteCandidatesGathered = false;
@@ -91,49 +217,92 @@ namespace webrtc {
     transportStarted = false;
     localDescription = nullptr;
     remoteDescription = nullptr;
+    localSdp = nullptr;
+    remoteSdp = nullptr;
+    localCandidatesGathered = false;
+    localCandidatesEnded = false;
+    strand = std::make_shared<Strand>();
 
     iceCompletePromise = nullptr;
     dtlsCompletePromise = nullptr;
+    connectTimeoutId = 0;
+
+    closed = false;
+    statsTransportsCount = 0;
+    statsStreamsCount = 0;
+    statsEntry.init((void*)this, &statsWheelCb);
+    gatheringDeadlineEntry.init((void*)this, &gatheringWheelCb);
+    iceCompleteSignalled = false;
+
+    auto& processMetrics = peerConnectionMetrics();
+    processMetrics.connections->add(1);
+    PeerConnectionMetrics::move(processMetrics.connectionStates, "", connectionState);
+    PeerConnectionMetrics::move(processMetrics.iceConnectionStates, "", iceConnectionState);
+    PeerConnectionMetrics::move(processMetrics.dtlsStates, "", dtlsState);
+    markPhase(SetupPhase::Created);
+  }
 
-    remoteIceCompletePromise = std::make_shared<promise::Promise<bool>>();
-
+  void PeerConnection::markPhase(SetupPhase phase) {
+    if(!setupTimeline.mark(phase)) return;
+    auto& processMetrics = peerConnectionMetrics();
+    for(SetupStage stage : SetupTimeline::stagesEndingAt(phase)) {
+      pj_int64_t duration = setupTimeline.duration(stage);
+      if(duration >= 0) processMetrics.setupStages[(int)stage].record(duration);
+    }
   }
 
-  void PeerConnection::init(PeerConnectionConfiguration& configurationp) {
-    configuration = configurationp;
+  void PeerConnection::setIceConnectionState(const char* state) {
+    if(iceConnectionState == state) return;
+    PeerConnectionMetrics::move(peerConnectionMetrics().iceConnectionStates, iceConnectionState, state);
+    iceConnectionState = state;
+    if(onIceConnectionStateChange) onIceConnectionStateChange(iceConnectionState);
+  }
 
-    pj_status_t status;
-    pool = pj_pool_create(&cachingPool.factory,"PeerConnection.pool", 4096, 4096, NULL);
-    assert( pj_timer_heap_create(pool, 100, &timerHeap) == PJ_SUCCESS );
+  void PeerConnection::setConnectionState(const char* state) {
+    if(connectionState == state) return;
+    PeerConnectionMetrics::move(peerConnectionMetrics().connectionStates, connectionState, state);
+    connectionState = state;
+    if(onConnectionStateChange) onConnectionStateChange(connectionState);
+  }
 
-    /* Create the endpoint: */
-    status = pjmedia_endpt_create(&cachingPool.factory, NULL, 1, &mediaEndpoint);
+  void PeerConnection::setDtlsState(const char* state) {
+    if(dtlsState == state) return;
+    PeerConnectionMetrics::move(peerConnectionMetrics().dtlsStates, dtlsState, state);
+    dtlsState = state;
+    for(int i = 0; i < statsTransportsCount; i++) {
+      transportCounters[i].dtlsState.store(state, std::memory_order_relaxed);
+    }
+  }
 
-    //pj_bool_t telephony = false;
-    //pjmedia_endpt_set_flag(mediaEndpoint, PJMEDIA_ENDPT_HAS_TELEPHONE_EVENT_FLAG, &telephony);
+  void PeerConnection::init(std::shared_ptr<EventLoop> eventLoopp, std::shared_ptr<MediaEngine> mediaEnginep,
+                            PeerConnectionConfiguration& configurationp) {
+    configuration = configurationp;
+    eventLoop = eventLoopp;
+    strand->init(eventLoop);
+    ioqueue = eventLoop->ioqueue;
+    timerHeap = eventLoop->timerHeap;
+    mediaEngine = mediaEnginep;
+    mediaEndpoint = mediaEngine->mediaEndpoint;
 
-    assert(status == PJ_SUCCESS);
-    status = pjmedia_codec_g711_init(mediaEndpoint);
-    assert(status == PJ_SUCCESS);
-    status = pjmedia_codec_g722_init(mediaEndpoint);
-    assert(status == PJ_SUCCESS);
-    status = pjmedia_codec_ilbc_init(mediaEndpoint, 30);
-    assert(status == PJ_SUCCESS);
-//    status = pjmedia_codec_opus_init(mediaEndpoint);
-//    assert(status == PJ_SUCCESS);
+    pool = pj_pool_create(&cachingPool.factory,"PeerConnection.pool", 4096, 4096, NULL);
 
     mediaTransportsIceInitializedCount = 0;
     mediaTransportsDtlsInitializedCount = 0;
 
-    pj_ioqueue_create(pool, 16, &ioqueue);
-
     pj_ice_strans_cfg_default(&iceTransportConfiguration);
     auto & cfg = iceTransportConfiguration;
     pj_stun_config_init(&cfg.stun_cfg, &cachingPool.factory, 0, ioqueue, timerHeap);
 
     cfg.turn.conn_type = PJ_TURN_TP_UDP;
+    cfg.opt.trickle = PJ_ICE_SESS_TRICKLE_FULL;
+
+    if(configuration.iceLite && !configuration.udpMux) {
+      /// Never a socket and reader thread per connection, see liteMux
+      configuration.udpMux = liteMux(eventLoop.get(), configuration.iceLiteMux);
+    }
 
-    for(auto& iceServer : configuration.iceServers) {
+    /* Lite agent advertises host candidates only, STUN and TURN servers are never contacted */
+    if(!configuration.iceLite) for(auto& iceServer : configuration.iceServers) {
       std::string uname("");
       std::string cred("");
       auto unamei = iceServer.find("username");
@@ -161,25 +330,54 @@ namespace webrtc {
   }
 
   void PeerConnection::addStream(std::shared_ptr<UserMedia> userMedia) {
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
     inputStreams.push_back(userMedia);
-    if(inputStreams.size() > mediaTransport.size()) gatherIceCandidates(inputStreams.size() - mediaTransport.size());
+    markPhase(SetupPhase::StreamAdded);
+    int missingTransports = getTransportsCount(inputStreams.size()) - mediaTransport.size();
+    if(missingTransports > 0) gatherIceCandidates(missingTransports);
+  }
+
+  bool PeerConnection::isBundled() {
+    /// Only audio exists, so "balanced" bundles everything just like "max-bundle"
+    return configuration.bundlePolicy != "max-compat";
+  }
+
+  int PeerConnection::getTransportsCount(int mediaCount) {
+    if(!isBundled()) return mediaCount;
+    return mediaCount > 0 ? 1 : 0;
+  }
+
+  int PeerConnection::getTransportIndex(int mLineIndex) {
+    return isBundled() ? 0 : mLineIndex;
   }
 
   std::shared_ptr<promise::Promise<bool>> PeerConnection::gatherIceCandidates(int streamsCount) {
-    /// TODO: Create promise here
-    if(!iceCompletePromise || iceCompletePromise->state == promise::Promise<bool>::PromiseState::Resolved)
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    pj_status_t status;
+    if(!iceCompletePromise || iceCompletePromise->state == promise::Promise<bool>::PromiseState::Resolved) {
       iceCompletePromise = std::make_shared<promise::Promise<bool>>();
+      iceCompleteSignalled = false;
+      markPhase(SetupPhase::GatheringStarted);
+    }
+
+    if(configuration.iceGatheringDeadlineMsec > 0) {
+      eventLoop->wheel.schedule(&gatheringDeadlineEntry, configuration.iceGatheringDeadlineMsec);
+    }
 
     iceGatheringState = "gathering";
     if(onIceGatheringStateChange) onIceGatheringStateChange(iceGatheringState);
 
-    pj_status_t status;
     for (int i = 0; i < streamsCount; i++) {
       mediaTransport.push_back(MediaTransport{nullptr, nullptr}); // make place for new transport
       auto& transport = mediaTransport[mediaTransport.size()-1];
-      status = pjmedia_ice_create3(mediaEndpoint, NULL, 1, &iceTransportConfiguration, &iceCallbacks,
-          PJMEDIA_ICE_RTCP_MUX, (void*)this, &transport.ice);
-      assert(status == PJ_SUCCESS);
+      /* Host candidates reported inside create3 wait on the strand until the transport pointer is stored */
+      if(configuration.udpMux) {
+        transport.ice = MuxTransport::create(configuration.udpMux, (void*)this);
+      } else {
+        status = pjmedia_ice_create3(mediaEndpoint, NULL, 1, &iceTransportConfiguration, &iceCallbacks,
+            PJMEDIA_ICE_RTCP_MUX, (void*)this, &transport.ice);
+        assert(status == PJ_SUCCESS);
+      }
 
 
      /* status = pjmedia_transport_mux_create(mediaEndpoint, transport.ice, &transport.mux);
@@ -190,175 +388,238 @@ namespace webrtc {
 
     }
 
+    if(configuration.udpMux) {
+      /// Shared port is the only candidate, known up front, so gathering completes right away
+      for(int i = mediaTransport.size() - streamsCount; i < mediaTransport.size(); i++) {
+        pj_ice_sess_cand cand;
+        MuxTransport::getCandidate(mediaTransport[i].ice, pool, &cand);
+        handleIceNewCandidate(mediaTransport[i].ice, IceCandidate(&cand));
+        handleIceTransportComplete(mediaTransport[i].ice);
+      }
+    }
+
     return iceCompletePromise;
   }
 
   void PeerConnection::handleIceTransportComplete(pjmedia_transport *pTransport) {
+    if(closed) return;
     printf("ICE COMPLETE?!\n");
     mediaTransportsIceInitializedCount++;
     if(mediaTransportsIceInitializedCount == mediaTransport.size()) {
       printf("ICE COMPLETE!!\n");
+      markPhase(SetupPhase::GatheringComplete);
       iceGatheringState = "complete";
       if(onIceGatheringStateChange) onIceGatheringStateChange(iceGatheringState);
-      iceCompletePromise->resolve(true);
+      {
+        std::lock_guard<std::mutex> lock(localCandidatesMutex);
+        localCandidatesGathered = true;
+      }
+      if(localDescription != nullptr) emitLocalCandidates();
+      eventLoop->wheel.cancel(&gatheringDeadlineEntry);
+      signalIceComplete();
+    }
+  }
+
+  bool PeerConnection::signalIceComplete() {
+    /// Deadline timer and the last gathering callback may race on different loop threads
+    if(iceCompleteSignalled.exchange(true)) return false;
+    iceCompletePromise->resolve(true);
+    return true;
+  }
+
+  void gatheringWheelCb(TimingWheelEntry* entry) {
+    /// Only posts, cancel() waits for wheel callbacks and is called with the strand held
+    PeerConnection* pc = (PeerConnection*)entry->userData;
+    pc->strand->execute([pc]() { pc->handleIceGatheringDeadline(); });
+  }
+
+  void PeerConnection::handleIceGatheringDeadline() {
+    if(closed) return;
+    /// Gathering goes on, late candidates are trickled through onIceCandidate
+    if(!signalIceComplete()) return; // gathering finished first
+    printf("ICE GATHERING DEADLINE HIT, GATHERING PROMISE RESOLVED WITH PARTIAL CANDIDATES\n");
+    PeerConnection::iceGatheringDeadlineHits++;
+  }
+
+  void PeerConnection::handleIceNewCandidate(pjmedia_transport *pTransport, const IceCandidate& candidate) {
+    if(closed) return;
+    {
+      std::lock_guard<std::mutex> lock(localCandidatesMutex);
+      int mLineIndex = -1;
+      for(int i = 0; i < mediaTransport.size(); i++) if(mediaTransport[i].ice == pTransport) mLineIndex = i;
+      pendingLocalCandidates.push_back(candidate);
+      pendingLocalCandidates.back().sdpMLineIndex = mLineIndex;
+    }
+    if(localDescription != nullptr) emitLocalCandidates();
+  }
+
+  void PeerConnection::emitLocalCandidates() {
+    std::vector<IceCandidate> candidates;
+    bool gathered;
+    {
+      std::lock_guard<std::mutex> lock(localCandidatesMutex);
+      candidates.swap(pendingLocalCandidates);
+      gathered = localCandidatesGathered && !localCandidatesEnded;
+      if(gathered) localCandidatesEnded = true;
+      for(auto& candidate : candidates) {
+        candidate.usernameFragment = localIceUfrag;
+        int mLineIndex = candidate.sdpMLineIndex;
+        if(mLineIndex >= 0 && mLineIndex < localMids.size()) candidate.sdpMid = localMids[mLineIndex];
+        localCandidates.push_back(candidate);
+      }
     }
+    if(!onIceCandidate) return;
+    for(auto& candidate : candidates) onIceCandidate(&candidate);
+    if(gathered) onIceCandidate(nullptr);
+  }
+
+  void PeerConnection::handleIceNegotiationComplete(pjmedia_transport *pTransport, pj_status_t status) {
+    if(closed) return;
+    if(status != PJ_SUCCESS) {
+      printf("ICE NEGOTIATION FAILED %d\n", status);
+      return; // connectTimeoutMsec takes care of the connection
+    }
+    mediaTransportsIceNegotiatedCount++;
+    if(mediaTransportsIceNegotiatedCount == mediaTransport.size()) markPhase(SetupPhase::ChecksComplete);
   }
 
   void PeerConnection::handleDtlsTransportComplete(pjmedia_transport *pTransport) {
+    if(closed) return;
     printf("DTLS COMPLETE?!\n");
     mediaTransportsDtlsInitializedCount++;
     if(mediaTransportsDtlsInitializedCount == mediaTransport.size()) {
       printf("DTLS COMPLETE!!\n");
+      markPhase(SetupPhase::DtlsComplete);
       dtlsCompletePromise->resolve(true);
     }
   }
 
+  /// Hands a generated description out, doCreateOffer and doCreateAnswer give null when it didn't print
+  static std::shared_ptr<promise::Promise<nlohmann::json>> describe(nlohmann::json&& description) {
+    if(description.is_null())
+      return promise::Promise<nlohmann::json>::rejected(promise::Error(PJ_ETOOBIG, "local description too large"));
+    return promise::Promise<nlohmann::json>::resolved(std::move(description));
+  }
+
   std::shared_ptr<promise::Promise<nlohmann::json>> PeerConnection::createOffer() {
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
     printf("CREATE OFFER?!");
-    if(mediaTransport.size() == 0) throw "zrob tu errora";
-    return iceCompletePromise->then<nlohmann::json>([this](bool& v) {
-      startTransportIfPossible();
-      return promise::Promise<nlohmann::json>::resolved(doCreateOffer());
-    });
+    if(mediaTransport.size() == 0)
+      return promise::Promise<nlohmann::json>::rejected(promise::Error(PJ_EINVALIDOP, "no media transport"));
+    /// Candidates gathered later follow through onIceCandidate, SdpWriter leaves them out anyway
+    startTransportIfPossible();
+    return describe(doCreateOffer());
   }
 
   std::shared_ptr<promise::Promise<nlohmann::json>> PeerConnection::createAnswer() {
-    if(mediaTransport.size() == 0) throw "zrob tu errora";
-    return iceCompletePromise->then<nlohmann::json>([this](bool& v) {
-      return remoteIceCompletePromise->then<nlohmann::json>([this](bool& v) {
-        startTransportIfPossible();
-        return promise::Promise<nlohmann::json>::resolved(doCreateAnswer(this->remoteDescription));
-      });
-    });
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    if(mediaTransport.size() == 0)
+      return promise::Promise<nlohmann::json>::rejected(promise::Error(PJ_EINVALIDOP, "no media transport"));
+    if(!remoteDescription)
+      return promise::Promise<nlohmann::json>::rejected(promise::Error(PJ_EINVALIDOP, "no remote description"));
+    /// Candidates are trickled both ways, the answer waits neither for ours nor for the remote ones
+    startTransportIfPossible();
+    return describe(doCreateAnswer());
   }
 
-  std::string replace(const std::string& data, const std::string& substr, const std::string& replacement)
-  {
-    std::string res;
-    std::string::const_iterator b = data.cbegin();
-    std::string::const_iterator e = data.cend();
-
-    std::string::const_iterator pos = search(b, e, substr.cbegin(), substr.cend());
-    while (pos != e)
+#if PROMISE_HAS_COROUTINES
+  std::shared_ptr<promise::Promise<bool>> PeerConnection::negotiate(nlohmann::json remoteOffer,
+                                                                    std::function<void(const nlohmann::json&)> signal) {
+    bool answering = !remoteOffer.is_null();
+    std::shared_ptr<promise::Promise<bool>> connected;
     {
-      std::copy(b, pos, back_inserter(res));
-      std::copy(begin(replacement), end(replacement), back_inserter(res));
-
-      b = pos + substr.size();
-      pos = search(b, e, substr.cbegin(), substr.cend());
+      /// Released before co_await, a suspended negotiation must not keep the strand locked
+      std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+      if(answering) setRemoteDescription(remoteOffer);
+      if(mediaTransport.size() == 0) co_return promise::Error(PJ_EINVALIDOP, "no media transport");
+      if(answering && !remoteDescription) co_return promise::Error(PJ_EINVALIDOP, "no remote description");
+      if(closed) co_return promise::Error(PJ_ECANCELLED, "closed");
+      /// Gathering is not awaited, candidates are trickled after the description
+      startTransportIfPossible();
+      nlohmann::json description = answering ? doCreateAnswer() : doCreateOffer();
+      if(description.is_null()) co_return promise::Error(PJ_ETOOBIG, "local description too large");
+      signal(description);
+      setLocalDescription(description);
+      connected = dtlsCompletePromise;
     }
-    std::copy(b, e, std::back_inserter(res));
-
-    return res;
+    /* Settled on the strand, DTLS completion or handleDisconnect, which may be the destructor, so nothing after
+       this touches the connection. A rejection is rethrown and rejects the returned promise. */
+    co_await connected;
+    co_return true;
+  }
+#endif
+
+  void PeerConnection::addMediaIds(pjmedia_sdp_session* sdp, bool bundle, int midExtensionId) {
+    std::string group = "BUNDLE";
+    for(int i = 0; i < sdp->media_count; i++) {
+      pj_str_t mid = pj_strdup3(pool, localMids[i].c_str());
+      pjmedia_sdp_media_add_attr(sdp->media[i], pjmedia_sdp_attr_create(pool, "mid", &mid));
+      /// Identical audio m-lines can only be told apart by MID until their SSRCs are latched
+      if(bundle && midExtensionId) addMidExtension(pool, sdp->media[i], midExtensionId);
+      if(bundle && i > 0) copyBundleAttributes(pool, sdp, 0, i);
+      group += " " + localMids[i];
+    }
+    if(!bundle) return;
+    pj_str_t groupValue = pj_strdup3(pool, group.c_str());
+    pjmedia_sdp_attr_add(&sdp->attr_count, sdp->attr, pjmedia_sdp_attr_create(pool, "group", &groupValue));
   }
 
   nlohmann::json PeerConnection::doCreateOffer() {
     printf("CREATE SDP!\n");
     pj_status_t status;
-    pj_sockaddr origin;
-    pj_str_t originString = pj_strdup3(pool, "localhost");
-    pj_sockaddr_parse(pj_AF_INET(), 0, &originString, &origin);
-    pjmedia_sdp_session *sdp;
-    status = pjmedia_endpt_create_base_sdp(mediaEndpoint, pool, NULL, &origin, &sdp);
-    assert(status == PJ_SUCCESS);
 
     for(int i = 0; i < mediaTransport.size(); i++) {
       auto& transport = mediaTransport[i];
       pjmedia_transport_media_create(transport.srtp, pool, 0, nullptr, i);
     }
 
-    pjmedia_transport_info transportInfo;
-
-    pjmedia_transport_info_init(&transportInfo);
-    pjmedia_transport_get_info(mediaTransport[0].ice, &transportInfo);
+    /// One m-line per stream, with BUNDLE they all ride on the first transport
+    int mediaCount = std::max(inputStreams.size(), mediaTransport.size());
+    localMids.clear();
+    for(int i = 0; i < mediaCount; i++) localMids.push_back(i == 0 ? "audio" : "audio" + std::to_string(i));
 
-    pjmedia_sdp_media* sdpMedia;
-
-    pj_sockaddr zero;
-    pj_str_t zeroString = pj_strdup3(pool, "0.0.0.0:9");
-    pj_sockaddr_parse(pj_AF_INET(), 0, &zeroString, &zero);
-
-    transportInfo.sock_info.rtp_addr_name = zero;
-    transportInfo.sock_info.rtcp_addr_name = zero;
-    
-    status = pjmedia_endpt_create_audio_sdp(mediaEndpoint, pool, &transportInfo.sock_info, 0, &sdpMedia);
-    assert(status == PJ_SUCCESS);
-    sdp->media[sdp->media_count++] = sdpMedia;
+    /// Codec part is the same for every call, only transports fill in their own attributes
+    pjmedia_sdp_session *sdp = mediaEngine->createSessionSdp(pool, mediaCount);
 
     for(int i = 0; i < mediaTransport.size(); i++) {
       auto& transport = mediaTransport[i];
       status = pjmedia_transport_encode_sdp(transport.srtp, pool, sdp, nullptr, i);
       assert(status == PJ_SUCCESS);
     }
+    addMediaIds(sdp, isBundled(), MID_EXTENSION_ID);
 
-    char buf[10240];
-    size_t offerSize = pjmedia_sdp_print(sdp, buf, 10240);
-    std::string rawSdpString(buf, offerSize);
-    //printf("\nRAW SDP:\n%s\n", rawSdpString.c_str());
-
-    std::istringstream iss(rawSdpString);
-    std::ostringstream oss;
-    std::string line;
-    std::string iceUfrag;
-    while(std::getline(iss, line, '\n')) {
-      printf("SDP LINE: %s\n", line.c_str());
-      if(line.substr(0, 12) == "a=candidate:") {
-        nlohmann::json candidate = {
-            {"candidate", line.substr(2, line.size()-3)/* + " generation 0"
-                          + " ufrag " + iceUfrag + " network-id 1"*/
-            },
-            {"sdpMLineIndex", 0},
-            {"sdpMid", "audio"},
-            {"usernameFragment", iceUfrag}
-        };
-        localCandidates.push_back(candidate);
-      }/* else if(line.substr(0, 7) == "m=audio") {
-        oss << replace(line, "SAVP", "SAVPF") << '\n';
-      }*/ else {
-        oss << line << '\n';
-        if(line.substr(0, 12) == "a=ice-ufrag:") {
-          iceUfrag = line.substr(12, line.size()-12-1);
-        }
-        if(line.substr(0, 10) == "a=ice-pwd:") {
-          oss << "a=ice-options:trickle\r\n";
-        }
-        if(line.substr(0, 7) == "m=audio") {
-          oss << "a=mid:audio\r\n";
-        }
-      }
-    }
+    sdpWriter.prepare(pool, sdp);
+    pj_str_t ufrag = findIceAttribute(sdp, 0, "ice-ufrag");
+    localIceUfrag = std::string(ufrag.ptr, ufrag.slen);
 
-    nlohmann::json sdpJson = { {"type", "offer"}, {"sdp", oss.str() } };
+    std::string text = sdpWriter.write(sdp);
+    if(text.empty()) return nullptr;
+    nlohmann::json sdpJson = { {"type", "offer"}, {"sdp", std::move(text) } };
+    generatedDescription = std::make_shared<SessionDescription>("offer", sdp);
 
     sdpGenerated = true;
+    markPhase(SetupPhase::OfferCreated);
 
     return sdpJson;
   }
 
-  nlohmann::json PeerConnection::doCreateAnswer(nlohmann::json offer) {
+  nlohmann::json PeerConnection::doCreateAnswer() {
     pj_status_t status;
 
-    printf("CREATE ANSWER FOR OFFER %s\n", offer.dump(2).c_str());
-
-    std::ostringstream oss;
-    oss << offer["sdp"].get<std::string>();
-    for(auto& candidate : remoteCandidates) {
-      oss << "a=" << candidate["candidate"].get<std::string>() << "\r\n";
+    /// Offer was parsed by setRemoteDescription
+    pjmedia_sdp_session* offerSdp = remoteDescription->sdp;
+
+    /// Answer has to reuse the mids of the offer
+    int mediaCount = std::max(inputStreams.size(), mediaTransport.size());
+    localMids.clear();
+    for(int i = 0; i < mediaCount; i++) {
+      pjmedia_sdp_attr* mid = i < offerSdp->media_count
+          ? pjmedia_sdp_media_find_attr2(offerSdp->media[i], "mid", nullptr) : nullptr;
+      if(mid) localMids.push_back(std::string(mid->value.ptr, mid->value.slen));
+      else localMids.push_back(i == 0 ? "audio" : "audio" + std::to_string(i));
     }
-    std::string sdpString = oss.str();
-
-    printf("REMOTE SDP WITH ICE:\n%s\n", sdpString.c_str());
 
-    pjmedia_sdp_session* offerSdp;
-    status = pjmedia_sdp_parse(pool, (char*)sdpString.data(), sdpString.size(), &offerSdp);
-    assert(status == PJ_SUCCESS);
-
-    pj_sockaddr origin;
-    pj_str_t originString = pj_strdup3(pool, "localhost");
-    pj_sockaddr_parse(pj_AF_INET(), 0, &originString, &origin);
-    pjmedia_sdp_session *sdp;
-    status = pjmedia_endpt_create_base_sdp(mediaEndpoint, pool, nullptr, &origin, &sdp);
-    assert(status == PJ_SUCCESS);
+    pjmedia_sdp_session *sdp = mediaEngine->createSessionSdp(pool, mediaCount);
 
     for(int i = 0; i < mediaTransport.size(); i++) {
       auto& transport = mediaTransport[i];
@@ -366,88 +627,142 @@ namespace webrtc {
       assert(status == PJ_SUCCESS);
     }
 
-    pjmedia_transport_info transportInfo;
-
-    pjmedia_transport_info_init(&transportInfo);
-    pjmedia_transport_get_info(mediaTransport[0].srtp, &transportInfo);
-
-    pjmedia_sdp_media* sdpMedia;
-
-    pj_sockaddr zero;
-    pj_str_t zeroString = pj_strdup3(pool, "0.0.0.0:9");
-    pj_sockaddr_parse(pj_AF_INET(), 0, &zeroString, &zero);
-
-    transportInfo.sock_info.rtp_addr_name = zero;
-    transportInfo.sock_info.rtcp_addr_name = zero;
-
-    status = pjmedia_endpt_create_audio_sdp(mediaEndpoint, pool, &transportInfo.sock_info, 0, &sdpMedia);
-    assert(status == PJ_SUCCESS);
-    sdp->media[sdp->media_count++] = sdpMedia;
-
     for(int i = 0; i < mediaTransport.size(); i++) {
       auto& transport = mediaTransport[i];
       status = pjmedia_transport_encode_sdp(transport.srtp, pool, sdp, offerSdp, i);
       assert(status == PJ_SUCCESS);
     }
+    pjmedia_sdp_attr* offerGroup = pjmedia_sdp_attr_find2(offerSdp->attr_count, offerSdp->attr, "group", nullptr);
+    bool offerBundled = offerGroup && pj_strncmp2(&offerGroup->value, "BUNDLE", 6) == 0;
+    int offerMidExtension = offerSdp->media_count > 0 ? findMidExtension(offerSdp->media[0]) : 0;
+    addMediaIds(sdp, isBundled() && offerBundled, offerMidExtension);
 
-    char buf[10240];
-    size_t offerSize = pjmedia_sdp_print(sdp, buf, 10240);
-    std::string rawSdpString(buf, offerSize);
-    //printf("\nRAW SDP:\n%s\n", rawSdpString.c_str());
-
-    std::istringstream iss(rawSdpString);
-    oss.str("");
-    std::string line;
-    std::string iceUfrag;
-    while(std::getline(iss, line, '\n')) {
-      printf("SDP LINE: %s\n", line.c_str());
-      if(line.substr(0, 12) == "a=candidate:") {
-        nlohmann::json candidate = {
-            {"candidate", line.substr(2, line.size()-3)/* + " generation 0"
-                          + " ufrag " + iceUfrag + " network-id 1"*/
-            },
-            {"sdpMLineIndex", 0},
-            {"sdpMid", "audio"},
-            {"usernameFragment", iceUfrag}
-        };
-        localCandidates.push_back(candidate);
-      } else {
-        oss << line << '\n';
-        if(line.substr(0, 12) == "a=ice-ufrag:") {
-          iceUfrag = line.substr(12, line.size()-12-1);
-        }
-        if(line.substr(0, 10) == "a=ice-pwd:") {
-          oss << "a=ice-options:trickle\r\n";
-        }
-        if(line.substr(0, 7) == "m=audio") {
-          oss << "a=mid:audio\r\n";
-        }
-      }
-    }
+    sdpWriter.prepare(pool, sdp);
+    pj_str_t ufrag = findIceAttribute(sdp, 0, "ice-ufrag");
+    localIceUfrag = std::string(ufrag.ptr, ufrag.slen);
 
-    nlohmann::json sdpJson = { { "type", "answer" }, { "sdp", oss.str() } };
+    std::string text = sdpWriter.write(sdp);
+    if(text.empty()) return nullptr;
+    nlohmann::json sdpJson = { { "type", "answer" }, { "sdp", std::move(text) } };
+    generatedDescription = std::make_shared<SessionDescription>("answer", sdp);
 
     sdpGenerated = true;
+    markPhase(SetupPhase::AnswerCreated);
 
     return sdpJson;
   }
 
   void PeerConnection::setLocalDescription(nlohmann::json sdp) {
-    localDescription = sdp;
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    /// Unchanged offer/answer reuses the structure it was printed from, munged text is parsed
+    auto sdpText = sdp.find("sdp");
+    if(generatedDescription && sdpText != sdp.end() && sdpText->is_string()
+       && sdpWriter.wrote(sdpText->get_ref<const std::string&>())) {
+      localDescription = generatedDescription;
+    } else {
+      localDescription = SessionDescription::parse(pool, sdp);
+    }
+    generatedDescription = nullptr;
+    if(!localDescription) {
+      printf("INVALID LOCAL SDP\n");
+      return;
+    }
+    markPhase(SetupPhase::LocalDescriptionSet);
+    emitLocalCandidates();
     startTransportIfPossible();
   }
   void PeerConnection::setRemoteDescription(nlohmann::json sdp) {
-    remoteDescription = sdp;
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    remoteDescription = SessionDescription::parse(pool, sdp);
+    if(!remoteDescription) {
+      printf("INVALID REMOTE SDP\n");
+      return;
+    }
+    markPhase(SetupPhase::RemoteDescriptionSet);
     startTransportIfPossible();
   }
   void PeerConnection::addIceCandidate(nlohmann::json candidate) {
-    if(candidate == nullptr) {
+    /// End of candidates comes as null or, from newer browsers, as an empty candidate line
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    auto line = candidate.is_object() ? candidate.find("candidate") : candidate.end();
+    if(candidate == nullptr || (line != candidate.end() && *line == "")) {
       remoteCandidatesGathered = true;
-      remoteIceCompletePromise->resolve(true);
+      updateRemoteCandidates();
+      return;
+    }
+    IceCandidate parsed;
+    if(!IceCandidate::fromJson(candidate, parsed)) {
+      printf("IGNORED REMOTE CANDIDATE %s\n", candidate.dump().c_str());
+      return;
+    }
+    addIceCandidate(parsed);
+  }
+
+  void PeerConnection::addIceCandidate(const IceCandidate& candidate) {
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    remoteCandidates.push_back(candidate);
+    updateRemoteCandidates();
+  }
+
+  void PeerConnection::updateRemoteCandidates() {
+    if(transportStarted) {
+      trickleRemoteCandidates();
     } else {
-      remoteCandidates.push_back(candidate);
+      startTransportIfPossible();
     }
-    startTransportIfPossible();
+  }
+
+  int PeerConnection::findMLineIndex(const IceCandidate& candidate) {
+    if(candidate.sdpMLineIndex >= 0) return candidate.sdpMLineIndex;
+    if(candidate.sdpMid.empty()) return -1;
+    if(remoteDescription) {
+      pjmedia_sdp_session* sdp = remoteDescription->sdp;
+      for(int i = 0; i < sdp->media_count; i++) {
+        pjmedia_sdp_attr* mid = pjmedia_sdp_media_find_attr2(sdp->media[i], "mid", nullptr);
+        if(mid && pj_strcmp2(&mid->value, candidate.sdpMid.c_str()) == 0) return i;
+      }
+    }
+    /// Answer reuses the offered mids, ours are the same list
+    for(int i = 0; i < localMids.size(); i++) if(localMids[i] == candidate.sdpMid) return i;
+    return -1;
+  }
+
+  void PeerConnection::trickleRemoteCandidates() {
+    pj_status_t status;
+    if(configuration.udpMux) {
+      /// ICE-lite learns the remote address from authenticated checks, candidates are not needed
+      remoteCandidates.clear();
+      return;
+    }
+    std::vector<int> transportIndexes;
+    for(auto& candidate : remoteCandidates) {
+      int mLineIndex = findMLineIndex(candidate);
+      if(mLineIndex < 0 || mLineIndex >= remoteSdp->media_count) {
+        printf("REMOTE CANDIDATE FOR UNKNOWN M-LINE %s DROPPED\n", candidate.sdpMid.c_str());
+        transportIndexes.push_back(-1);
+      } else {
+        transportIndexes.push_back(getTransportIndex(mLineIndex));
+      }
+    }
+    for(int i = 0; i < mediaTransport.size(); i++) {
+      std::vector<pj_ice_sess_cand> candidates;
+      for(int j = 0; j < remoteCandidates.size(); j++) {
+        if(transportIndexes[j] != i) continue;
+        if(remoteCandidates[j].component != 1) continue; // rtcp is muxed, there is only one component
+        pj_ice_sess_cand cand;
+        remoteCandidates[j].toIceSessCand(pool, &cand);
+        candidates.push_back(cand);
+      }
+      if(candidates.size() == 0 && !remoteCandidatesGathered) continue;
+      pj_str_t ufrag = findIceAttribute(remoteSdp, i, "ice-ufrag");
+      pj_str_t pwd = findIceAttribute(remoteSdp, i, "ice-pwd");
+      status = pjmedia_ice_trickle_update(mediaTransport[i].ice, &ufrag, &pwd,
+                                          candidates.size(), candidates.data(), remoteCandidatesGathered);
+      /// Bad candidates or credentials come from the remote side, they must not take the process down
+      if(status != PJ_SUCCESS) printf("ICE TRICKLE UPDATE FAILED %d, %d CANDIDATES DROPPED\n", status,
+                                      (int)candidates.size());
+    }
+    remoteCandidates.clear();
   }
 
   void PeerConnection::startTransportIfPossible() {
@@ -455,70 +770,89 @@ namespace webrtc {
       dtlsCompletePromise = std::make_shared<promise::Promise<bool>>();
 
     pj_status_t status;
-    printf("START TRANSPORT? %d %d %d\n", remoteCandidatesGathered, localDescription != nullptr, remoteDescription != nullptr);
-    if(!(remoteCandidatesGathered && localDescription != nullptr && remoteDescription != nullptr
-         && sdpGenerated && !transportStarted)) return;
+    printf("START TRANSPORT? %d %d\n", localDescription != nullptr, remoteDescription != nullptr);
+    if(!(localDescription != nullptr && remoteDescription != nullptr && sdpGenerated && !transportStarted)) return;
 
     transportStarted = true;
+    markPhase(SetupPhase::TransportStarted);
 
     printf("START TRANSPORT!\n");
 
-    iceConnectionState = "checking";
-    if(onIceConnectionStateChange) onIceConnectionStateChange(iceConnectionState);
-
-    connectionState = "connecting";
-    if(onConnectionStateChange) onConnectionStateChange(connectionState);
+    setIceConnectionState("checking");
+    setConnectionState("connecting");
+    setDtlsState("connecting");
 
-    std::ostringstream oss;
-    oss << localDescription["sdp"].get<std::string>();
-    for(auto& candidate : localCandidates) {
-      oss << "a=" << candidate["candidate"].get<std::string>() << "\r\n";
-    }
-    localWithIce = oss.str();
-    oss.str("");
-    oss << remoteDescription["sdp"].get<std::string>();
-    for(auto& candidate : remoteCandidates) {
-      oss << "a=" << candidate["candidate"].get<std::string>() << "\r\n";
+    localSdp = localDescription->sdp;
+    remoteSdp = remoteDescription->sdp;
+    {
+      std::lock_guard<std::mutex> lock(localCandidatesMutex);
+      for(auto& candidate : localCandidates) localDescription->addCandidate(pool, candidate);
     }
-    remoteWithIce = oss.str();
 
-    printf("PREPARED LOCAL SDP: \n%s\n", localWithIce.c_str());
-    printf("PREPARED REMOTE SDP: \n%s\n", remoteWithIce.c_str());
-
-    status = pjmedia_sdp_parse(pool, (char*)localWithIce.data(), localWithIce.size(), &localSdp);
-    assert(status == PJ_SUCCESS);
-    status = pjmedia_sdp_parse(pool, (char*)remoteWithIce.data(), remoteWithIce.size(), &remoteSdp);
-    assert(status == PJ_SUCCESS);
-
-    printf("LOCAL AND REMOTE SDP PARSED!\n");
-
-    mediaStreams.resize(mediaTransport.size());
+    mediaStreams.resize(localSdp->media_count);
 
     for(int i = 0; i < mediaTransport.size(); i++) {
       auto transport = mediaTransport[i].srtp;
       status = pjmedia_transport_media_start(transport, pool, localSdp, remoteSdp, i);
       assert(status == PJ_SUCCESS);
     }
+
+    for(int i = 0; i < mediaStreams.size(); i++) {
+      mediaStreams[i].transport = mediaTransport[getTransportIndex(i)].srtp;
+    }
+    if(mediaStreams.size() > mediaTransport.size()) {
+      /// Several m-lines on one transport, streams attach to demultiplexing members instead
+      bundleGroup.reset(new BundleGroup(mediaTransport[0].srtp));
+      for(int i = 0; i < mediaStreams.size(); i++) mediaStreams[i].transport = bundleGroup->createMember(pool, i);
+      bundleGroup->setRemoteDescription(remoteSdp);
+    }
     printf("MEDIA TRANSPORTS STARTED\n");
 
-    dtlsCompletePromise->onResolved([this](bool ok){
-      iceConnectionState = "completed";
-      if(onIceConnectionStateChange) onIceConnectionStateChange(iceConnectionState);
-      startMedia();
+    /// Candidates received before the session existed, later ones go straight from addIceCandidate
+    trickleRemoteCandidates();
+
+    /// Continuations and the timeout run as strand tasks and hold the connection weakly,
+    /// handleDisconnect clears the timeout and rejects the promise
+    std::weak_ptr<PeerConnection> weakThis = shared_from_this();
+    dtlsCompletePromise->on(strand)->onResolved([weakThis](bool ok){
+      auto pc = weakThis.lock();
+      if(!pc || pc->closed) return;
+      if(pc->connectTimeoutId) pc->strand->clearTimeout(pc->connectTimeoutId);
+      pc->connectTimeoutId = 0;
+      pc->setIceConnectionState("completed");
+      pc->setDtlsState("connected");
+      pc->startMedia();
     });
+    if(configuration.connectTimeoutMsec > 0) {
+      connectTimeoutId = strand->setTimeout([weakThis]() {
+        auto pc = weakThis.lock();
+        if(pc) pc->handleConnectTimeout();
+      }, configuration.connectTimeoutMsec);
+    }
+  }
+
+  void PeerConnection::handleConnectTimeout() {
+    connectTimeoutId = 0;
+    if(closed) return;
+    printf("CONNECT TIMEOUT, RELEASING TRANSPORTS\n");
+    setIceConnectionState("failed");
+    setConnectionState("failed");
+    setDtlsState("failed");
+    handleDisconnect();
   }
 
   void PeerConnection::startMedia() {
 
     printf("START MEDIA!!!\n");
-    for(int i = 0; i < mediaTransport.size(); i++) {
+    streamCounters.reset(new MediaStreamCounters[mediaStreams.size()]);
+    for(int i = 0; i < mediaStreams.size(); i++) {
       pj_status_t status;
 
       pjmedia_stream_info stream_info;
       auto& stream = mediaStreams[i];
 
       pjmedia_transport_info transportInfo;
-      pjmedia_transport_get_info(mediaTransport[i].ice, &transportInfo);
+      pjmedia_transport_get_info(mediaTransport[getTransportIndex(i)].ice, &transportInfo);
       /*remoteSdp->media[i]->conn->addr = transportInfo.sock_info.*/
 
       pjmedia_sdp_media* sdpMedia;
@@ -540,7 +874,19 @@ namespace webrtc {
 
       stream_info.param->setting.vad = 0;
 
-      pjmedia_stream_create(mediaEndpoint, pool, &stream_info, mediaTransport[i].srtp, (void*)this, &stream.stream);
+      auto& counters = streamCounters[i];
+      counters.mid = localMids[i];
+      counters.kind = std::string(localSdp->media[i]->desc.media.ptr, localSdp->media[i]->desc.media.slen);
+      counters.ssrc = stream_info.ssrc;
+      counters.transportIndex = getTransportIndex(i);
+      counters.codec.payloadType = stream_info.fmt.pt;
+      counters.codec.mimeType = counters.kind + "/" + std::string(stream_info.fmt.encoding_name.ptr,
+                                                                 stream_info.fmt.encoding_name.slen);
+      counters.codec.clockRate = stream_info.fmt.clock_rate;
+      counters.codec.channels = stream_info.fmt.channel_cnt;
+      counters.codec.id = "C" + std::to_string(stream_info.fmt.pt);
+
+      pjmedia_stream_create(mediaEndpoint, pool, &stream_info, stream.transport, (void*)this, &stream.stream);
       assert(status == PJ_SUCCESS);
 
       printf("STREAM ENCODING = %d \n", stream_info.dir & PJMEDIA_DIR_ENCODING);
@@ -563,217 +909,281 @@ namespace webrtc {
       status = pjmedia_snd_port_connect(stream.soundPort, stream.mediaPort);
       assert(status == PJ_SUCCESS);
 
-      connectionState = "connected";
-      if(onConnectionStateChange) onConnectionStateChange(connectionState);
+      setConnectionState("connected");
 
       //pjmedia_transport_simulate_lost(mediaTransport[i].mux, PJMEDIA_DIR_ENCODING_DECODING, 20);
 
     }
-    scheduleReadStats(2, 0);
+    publishStatsTransports();
+    markPhase(SetupPhase::MediaStarted);
+    /* Periodic on the loop's wheel, so thousands of connections cost one wakeup per tick, not a heap entry each */
+    eventLoop->wheel.schedule(&statsEntry, 2000, 1000);
   }
 
-  static const char *good_number(char *buf, pj_int32_t val)
-  {
-    if (val < 1000) {
-      pj_ansi_sprintf(buf, "%d", val);
-    } else if (val < 1000000) {
-      pj_ansi_sprintf(buf, "%d.%dK",
-                      val / 1000,
-                      (val % 1000) / 100);
-    } else {
-      pj_ansi_sprintf(buf, "%d.%02dM",
-                      val / 1000000,
-                      (val % 1000000) / 10000);
+  void PeerConnection::publishStatsTransports() {
+    char address[PJ_INET6_ADDRSTRLEN + 10];
+    transportCounters.reset(new TransportCounters[mediaTransport.size()]);
+    for(int i = 0; i < mediaTransport.size(); i++) {
+      auto& counters = transportCounters[i];
+      pjmedia_transport_info info;
+      pjmedia_transport_info_init(&info);
+      pjmedia_transport_get_info(mediaTransport[i].srtp, &info);
+      auto ice = (pjmedia_ice_transport_info*)pjmedia_transport_info_get_spc_info(&info, PJMEDIA_TRANSPORT_TYPE_ICE);
+      if(ice && ice->comp_cnt > 0 && ice->comp[0].valid) {
+        counters.localCandidateType = pj_ice_get_cand_type_name(ice->comp[0].lcand_type);
+        counters.localAddress = pj_sockaddr_print(&ice->comp[0].lcand_addr, address, sizeof(address), 3);
+        counters.remoteCandidateType = pj_ice_get_cand_type_name(ice->comp[0].rcand_type);
+        counters.remoteAddress = pj_sockaddr_print(&ice->comp[0].rcand_addr, address, sizeof(address), 3);
+        counters.valid = true;
+      } else if(!ice && info.src_rtp_name.addr.sa_family != 0) {
+        /// Lite transport, the remote address is whatever its checks came from
+        counters.localCandidateType = "host";
+        counters.localAddress = pj_sockaddr_print(&info.sock_info.rtp_addr_name, address, sizeof(address), 3);
+        counters.remoteCandidateType = "prflx";
+        counters.remoteAddress = pj_sockaddr_print(&info.src_rtp_name, address, sizeof(address), 3);
+        counters.valid = true;
+      }
+      counters.dtlsState.store("connected", std::memory_order_relaxed);
     }
-
-    return buf;
+    statsTransportsCount = mediaTransport.size();
+    statsStreamsCount.store(mediaStreams.size(), std::memory_order_release);
   }
 
   void PeerConnection::readStats() {
-    char duration[80], last_update[80];
-    char bps[16], ipbps[16], packets[16], bytes[16], ipbytes[16];
-
-    printf("READ STREAM STATS(%zd)!\n", mediaStreams.size());
-
-    for(int i = 0; i < mediaStreams.size(); i++) {
+    if(closed) return; // posted before handleDisconnect cancelled the entry
+    int streamsCount = statsStreamsCount.load(std::memory_order_relaxed);
+    int stalledCount = 0;
+    for(int i = 0; i < streamsCount; i++) {
       pjmedia_rtcp_stat stat;
-      pjmedia_port *port;
-      pj_time_val now;
-      pj_gettimeofday(&now);
       pjmedia_stream_get_stat(mediaStreams[i].stream, &stat);
-      pjmedia_stream_get_port(mediaStreams[i].stream, &port);
-
-      printf("Stream #%d statistics:\n", i);
-
-      /* Print duration */
-      PJ_TIME_VAL_SUB(now, stat.start);
-      sprintf(duration, " Duration: %02ld:%02ld:%02ld.%03ld",
-              now.sec / 3600,
-              (now.sec % 3600) / 60,
-              (now.sec % 60),
-              now.msec);
-
-      if (stat.rx.update_cnt == 0)
-        strcpy(last_update, "never");
-      else {
-        pj_gettimeofday(&now);
-        PJ_TIME_VAL_SUB(now, stat.rx.update);
-        sprintf(last_update, "%02ldh:%02ldm:%02ld.%03lds ago",
-                now.sec / 3600,
-                (now.sec % 3600) / 60,
-                now.sec % 60,
-                now.msec);
-      }
-
-      printf(" RX stat last update: %s\n"
-             "    total %s packets %sB received (%sB +IP hdr)%s\n"
-             "    pkt loss=%d (%3.1f%%), dup=%d (%3.1f%%), reorder=%d (%3.1f%%)%s\n"
-             "          (msec)    min     avg     max     last    dev\n"
-             "    loss period: %7.3f %7.3f %7.3f %7.3f %7.3f%s\n"
-             "    jitter     : %7.3f %7.3f %7.3f %7.3f %7.3f%s\n",
-             last_update,
-             good_number(packets, stat.rx.pkt),
-             good_number(bytes, stat.rx.bytes),
-             good_number(ipbytes, stat.rx.bytes + stat.rx.pkt * 32),
-             "",
-             stat.rx.loss,
-             stat.rx.loss * 100.0 / (stat.rx.pkt + stat.rx.loss),
-             stat.rx.dup,
-             stat.rx.dup * 100.0 / (stat.rx.pkt + stat.rx.loss),
-             stat.rx.reorder,
-             stat.rx.reorder * 100.0 / (stat.rx.pkt + stat.rx.loss),
-             "",
-             stat.rx.loss_period.min / 1000.0,
-             stat.rx.loss_period.mean / 1000.0,
-             stat.rx.loss_period.max / 1000.0,
-             stat.rx.loss_period.last / 1000.0,
-             pj_math_stat_get_stddev(&stat.rx.loss_period) / 1000.0,
-             "",
-             stat.rx.jitter.min / 1000.0,
-             stat.rx.jitter.mean / 1000.0,
-             stat.rx.jitter.max / 1000.0,
-             stat.rx.jitter.last / 1000.0,
-             pj_math_stat_get_stddev(&stat.rx.jitter) / 1000.0,
-             ""
-      );
-
-      if (stat.tx.update_cnt == 0)
-        strcpy(last_update, "never");
-      else {
-        pj_gettimeofday(&now);
-        PJ_TIME_VAL_SUB(now, stat.tx.update);
-        sprintf(last_update, "%02ldh:%02ldm:%02ld.%03lds ago",
-                now.sec / 3600,
-                (now.sec % 3600) / 60,
-                now.sec % 60,
-                now.msec);
-      }
-
-      printf(" TX stat last update: %s\n"
-             "    total %s packets %sB sent (%sB +IP hdr)%s\n"
-             "    pkt loss=%d (%3.1f%%), dup=%d (%3.1f%%), reorder=%d (%3.1f%%)%s\n"
-             "          (msec)    min     avg     max     last    dev\n"
-             "    loss period: %7.3f %7.3f %7.3f %7.3f %7.3f%s\n"
-             "    jitter     : %7.3f %7.3f %7.3f %7.3f %7.3f%s\n",
-             last_update,
-             good_number(packets, stat.tx.pkt),
-             good_number(bytes, stat.tx.bytes),
-             good_number(ipbytes, stat.tx.bytes + stat.tx.pkt * 32),
-             "",
-             stat.tx.loss,
-             stat.tx.loss * 100.0 / (stat.tx.pkt + stat.tx.loss),
-             stat.tx.dup,
-             stat.tx.dup * 100.0 / (stat.tx.pkt + stat.tx.loss),
-             stat.tx.reorder,
-             stat.tx.reorder * 100.0 / (stat.tx.pkt + stat.tx.loss),
-             "",
-             stat.tx.loss_period.min / 1000.0,
-             stat.tx.loss_period.mean / 1000.0,
-             stat.tx.loss_period.max / 1000.0,
-             stat.tx.loss_period.last / 1000.0,
-             pj_math_stat_get_stddev(&stat.tx.loss_period) / 1000.0,
-             "",
-             stat.tx.jitter.min / 1000.0,
-             stat.tx.jitter.mean / 1000.0,
-             stat.tx.jitter.max / 1000.0,
-             stat.tx.jitter.last / 1000.0,
-             pj_math_stat_get_stddev(&stat.tx.jitter) / 1000.0,
-             ""
-      );
-
-
-      printf(" RTT delay     : %7.3f %7.3f %7.3f %7.3f %7.3f%s\n",
-             stat.rtt.min / 1000.0,
-             stat.rtt.mean / 1000.0,
-             stat.rtt.max / 1000.0,
-             stat.rtt.last / 1000.0,
-             pj_math_stat_get_stddev(&stat.rtt) / 1000.0,
-             ""
-      );
-
-      /*if(now.sec > 10) {
-        connectionState = "failed";
-        if(onConnectionStateChange) onConnectionStateChange(connectionState);
-        iceConnectionState = "failed";
-        if(onIceConnectionStateChange) onIceConnectionStateChange(iceConnectionState);
-        handleDisconnect();
-      }*/
-
       pjmedia_stream_rtp_sess_info rtp_info;
       pjmedia_stream_get_rtp_session_info(mediaStreams[i].stream, &rtp_info);
-      unsigned int rtpTs = rtp_info.rtcp->rtp_last_ts;
-      if(rtpTs == lastRtpTs) {
-        return handleDisconnect();
+
+      auto& counters = streamCounters[i];
+      auto& processMetrics = peerConnectionMetrics();
+      counters.remoteSsrc.store(rtp_info.rtcp->peer_ssrc, std::memory_order_relaxed);
+      publishTotal<unsigned long>(counters.packetsReceived, stat.rx.pkt, processMetrics.packetsReceived);
+      publishTotal<unsigned long>(counters.bytesReceived, stat.rx.bytes, processMetrics.bytesReceived);
+      publishTotal<long>(counters.packetsLost, stat.rx.loss, processMetrics.packetsLost);
+      counters.packetsDuplicated.store(stat.rx.dup, std::memory_order_relaxed);
+      counters.packetsReordered.store(stat.rx.reorder, std::memory_order_relaxed);
+      counters.jitterUsec.store(stat.rx.jitter.last, std::memory_order_relaxed);
+      if(stat.rx.update_cnt > 0) {
+        pj_int64_t msec = (pj_int64_t)stat.rx.update.sec * 1000 + stat.rx.update.msec;
+        counters.lastPacketReceivedMsec.store(msec, std::memory_order_relaxed);
       }
-      lastRtpTs = rtpTs;
+      publishTotal<unsigned long>(counters.packetsSent, stat.tx.pkt, processMetrics.packetsSent);
+      publishTotal<unsigned long>(counters.bytesSent, stat.tx.bytes, processMetrics.bytesSent);
+      counters.remotePacketsLost.store(stat.tx.loss, std::memory_order_relaxed);
+      counters.remoteJitterUsec.store(stat.tx.jitter.last, std::memory_order_relaxed);
+      counters.roundTripTimeUsec.store(stat.rtt.last, std::memory_order_relaxed);
+
+      if(stat.rx.jitter.n > 0) {
+        processMetrics.jitter->observe(stat.rx.jitter.last);
+        counters.jitterHistogram.record(stat.rx.jitter.last);
+      }
+      if(stat.rtt.n > 0) {
+        processMetrics.roundTripTime->observe(stat.rtt.last);
+        counters.roundTripTimeHistogram.record(stat.rtt.last);
+      }
+      if(stat.rx.loss_period.n != counters.lossPeriodsSeen) {
+        counters.lossPeriodsSeen = stat.rx.loss_period.n;
+        processMetrics.lossPeriod->observe(stat.rx.loss_period.last);
+        counters.lossPeriodHistogram.record(stat.rx.loss_period.last);
+      }
+      if(stat.rx.pkt > 0 && !setupTimeline.time(SetupPhase::FirstRtp)) markPhase(SetupPhase::FirstRtp);
 
+      pj_uint32_t rtpTs = rtp_info.rtcp->rtp_last_ts;
+      if(rtpTs == counters.lastRtpTs) stalledCount++;
+      counters.lastRtpTs = rtpTs;
     }
+    /// A quiet stream alone may just be muted, the peer is gone when none of them moved
+    if(streamsCount > 0 && stalledCount == streamsCount) {
+      printf("RTP STALLED, DISCONNECTING\n");
+      setIceConnectionState("disconnected");
+      setConnectionState("disconnected");
+      handleDisconnect();
+    }
+  }
 
-    scheduleReadStats(1, 0);
+  SetupStats PeerConnection::getSetupStats() {
+    auto& processMetrics = peerConnectionMetrics();
+    auto& stages = processMetrics.setupStages;
+    SetupStats stats;
+    stats.iceGathering = LatencySummary::of(stages[(int)SetupStage::IceGathering]);
+    stats.negotiation = LatencySummary::of(stages[(int)SetupStage::Negotiation]);
+    stats.iceChecking = LatencySummary::of(stages[(int)SetupStage::IceChecking]);
+    stats.dtlsHandshake = LatencySummary::of(stages[(int)SetupStage::DtlsHandshake]);
+    stats.mediaStart = LatencySummary::of(stages[(int)SetupStage::MediaStart]);
+    stats.firstRtp = LatencySummary::of(stages[(int)SetupStage::FirstRtp]);
+    return stats;
   }
 
-  void statTimerCb(pj_timer_heap_t *ht, pj_timer_entry *e) {
-    PeerConnection* pc = (PeerConnection*)e->user_data;
-    pc->readStats();
+  void PeerConnection::appendSetupTrace(nlohmann::json& traceEvents) const {
+    setupTimeline.appendTraceEvents(traceEvents, pj_getpid(), id);
   }
-  void PeerConnection::scheduleReadStats(int secs, int msecs) {
-    pj_status_t status;
-    pj_time_val delay;
-    delay.sec = secs;
-    delay.msec = msecs;
-    pj_timer_entry_init(&statTimerEntry, 0, (void*)this, statTimerCb );
-    /*statTimerEntry.user_data = (void*)this;
-    statTimerEntry.cb = statTimerCb;*/
-    status = pj_timer_heap_schedule(timerHeap, &statTimerEntry, &delay);
-    assert(status == PJ_SUCCESS);
+
+  nlohmann::json PeerConnection::getSetupTrace() const {
+    nlohmann::json traceEvents = nlohmann::json::array();
+    appendSetupTrace(traceEvents);
+    return {{"traceEvents", traceEvents}, {"displayTimeUnit", "ms"}};
+  }
+
+  PeerConnectionStats PeerConnection::getStats() const {
+    PeerConnectionStats stats;
+    pj_time_val now;
+    pj_gettimeofday(&now);
+    stats.timestamp = now.sec * 1000.0 + now.msec;
+
+    pj_int64_t createdTime = setupTimeline.time(SetupPhase::Created);
+    for(int i = 0; i < (int)SetupPhase::Count; i++) {
+      pj_int64_t phaseTime = setupTimeline.time((SetupPhase)i);
+      if(phaseTime) stats.setupPhases.push_back({setupPhaseName((SetupPhase)i), (phaseTime - createdTime) / 1000000.0});
+    }
+    for(int i = 0; i < (int)SetupStage::Count; i++) {
+      pj_int64_t duration = setupTimeline.duration((SetupStage)i);
+      if(duration >= 0) stats.setupStages.push_back({setupStageName((SetupStage)i), duration / 1000000.0});
+    }
+
+    int streamsCount = statsStreamsCount.load(std::memory_order_acquire);
+    if(streamsCount == 0) return stats;
+
+    std::vector<unsigned long> transportSent(statsTransportsCount, 0), transportReceived(statsTransportsCount, 0);
+    std::vector<unsigned> transportRtt(statsTransportsCount, 0);
+    for(int i = 0; i < streamsCount; i++) {
+      auto& counters = streamCounters[i];
+      std::string transportId = "T" + std::to_string(counters.transportIndex);
+
+      bool codecListed = false;
+      for(auto& codec : stats.codecs) codecListed = codecListed || codec.id == counters.codec.id;
+      if(!codecListed) stats.codecs.push_back(counters.codec);
+
+      InboundRtpStreamStats inbound;
+      inbound.id = "IR" + counters.mid;
+      inbound.kind = counters.kind;
+      inbound.mid = counters.mid;
+      inbound.ssrc = counters.remoteSsrc.load(std::memory_order_relaxed);
+      inbound.codecId = counters.codec.id;
+      inbound.transportId = transportId;
+      inbound.packetsReceived = counters.packetsReceived.load(std::memory_order_relaxed);
+      inbound.bytesReceived = counters.bytesReceived.load(std::memory_order_relaxed);
+      inbound.packetsLost = counters.packetsLost.load(std::memory_order_relaxed);
+      inbound.packetsDuplicated = counters.packetsDuplicated.load(std::memory_order_relaxed);
+      inbound.packetsReordered = counters.packetsReordered.load(std::memory_order_relaxed);
+      inbound.jitter = counters.jitterUsec.load(std::memory_order_relaxed) / 1000000.0;
+      inbound.jitterDistribution = LatencySummary::of(counters.jitterHistogram);
+      inbound.lossPeriodDistribution = LatencySummary::of(counters.lossPeriodHistogram);
+      inbound.lastPacketReceivedTimestamp = counters.lastPacketReceivedMsec.load(std::memory_order_relaxed);
+      stats.inboundRtp.push_back(std::move(inbound));
+
+      OutboundRtpStreamStats outbound;
+      outbound.id = "OR" + counters.mid;
+      outbound.kind = counters.kind;
+      outbound.mid = counters.mid;
+      outbound.ssrc = counters.ssrc;
+      outbound.codecId = counters.codec.id;
+      outbound.transportId = transportId;
+      outbound.packetsSent = counters.packetsSent.load(std::memory_order_relaxed);
+      outbound.bytesSent = counters.bytesSent.load(std::memory_order_relaxed);
+      outbound.remotePacketsLost = counters.remotePacketsLost.load(std::memory_order_relaxed);
+      outbound.remoteJitter = counters.remoteJitterUsec.load(std::memory_order_relaxed) / 1000000.0;
+      outbound.roundTripTime = counters.roundTripTimeUsec.load(std::memory_order_relaxed) / 1000000.0;
+      outbound.roundTripTimeDistribution = LatencySummary::of(counters.roundTripTimeHistogram);
+
+      if(counters.transportIndex < statsTransportsCount) {
+        transportSent[counters.transportIndex] += outbound.bytesSent;
+        transportReceived[counters.transportIndex] += stats.inboundRtp.back().bytesReceived;
+        if(!transportRtt[counters.transportIndex])
+          transportRtt[counters.transportIndex] = counters.roundTripTimeUsec.load(std::memory_order_relaxed);
+      }
+      stats.outboundRtp.push_back(std::move(outbound));
+    }
+
+    for(int i = 0; i < statsTransportsCount; i++) {
+      auto& counters = transportCounters[i];
+      std::string transportId = "T" + std::to_string(i);
+
+      TransportStats transport;
+      transport.id = transportId;
+      transport.dtlsState = counters.dtlsState.load(std::memory_order_relaxed);
+      transport.bytesSent = transportSent[i];
+      transport.bytesReceived = transportReceived[i];
+      if(counters.valid) {
+        IceCandidatePairStats pair;
+        pair.id = "CP" + std::to_string(i);
+        pair.transportId = transportId;
+        pair.localCandidateType = counters.localCandidateType;
+        pair.localAddress = counters.localAddress;
+        pair.remoteCandidateType = counters.remoteCandidateType;
+        pair.remoteAddress = counters.remoteAddress;
+        pair.state = "succeeded";
+        pair.nominated = true;
+        pair.bytesSent = transportSent[i];
+        pair.bytesReceived = transportReceived[i];
+        pair.currentRoundTripTime = transportRtt[i] / 1000000.0;
+        transport.selectedCandidatePairId = pair.id;
+        stats.candidatePairs.push_back(std::move(pair));
+      }
+      stats.transports.push_back(std::move(transport));
+    }
+    return stats;
+  }
+
+  void statsWheelCb(TimingWheelEntry* entry) {
+    PeerConnection* pc = (PeerConnection*)entry->userData;
+    pc->strand->execute([pc]() { pc->readStats(); });
   }
 
   void PeerConnection::handleDisconnect() {
+    if(closed) return;
     printf("STOP MEDIA!!!\n");
-    for(int i = 0; i < mediaTransport.size(); i++) {
-      pj_status_t status;
+    if(connectTimeoutId) strand->clearTimeout(connectTimeoutId);
+    connectTimeoutId = 0;
+    if(dtlsCompletePromise && dtlsCompletePromise->state == promise::Promise<bool>::PromiseState::Pending)
+      dtlsCompletePromise->reject(promise::Error(PJ_ECANCELLED, "connection closed"));
+    /* Wheel is shared with other connections, entries must not outlive us */
+    if(eventLoop) {
+      eventLoop->wheel.cancel(&statsEntry);
+      eventLoop->wheel.cancel(&gatheringDeadlineEntry);
+    }
+    for(int i = 0; i < mediaStreams.size(); i++) {
+      if(!mediaStreams[i].stream) continue;
       pjmedia_stream_destroy(mediaStreams[i].stream);
       pjmedia_snd_port_disconnect(mediaStreams[i].soundPort);
       pjmedia_port_destroy(mediaStreams[i].mediaPort);
       pjmedia_snd_port_destroy(mediaStreams[i].soundPort);
-
+    }
+    if(bundleGroup) {
+      for(int i = 0; i < mediaStreams.size(); i++) pjmedia_transport_close(mediaStreams[i].transport);
+      bundleGroup.reset();
+    }
+    /* Sockets are registered in the shared ioqueue, so transports must be closed even if media never started */
+    for(int i = 0; i < mediaTransport.size(); i++) {
       pjmedia_transport_close(mediaTransport[i].srtp);
     }
+    setDtlsState("closed");
+    markPhase(SetupPhase::Closed);
     closed = true;
   }
 
   void PeerConnection::close() {
-    connectionState = "closed";
-    if(onConnectionStateChange) onConnectionStateChange(connectionState);
-    iceConnectionState = "closed";
-    if(onIceConnectionStateChange) onIceConnectionStateChange(iceConnectionState);
+    std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+    setConnectionState("closed");
+    setIceConnectionState("closed");
   }
 
   PeerConnection::~PeerConnection() {
-    if(!closed) handleDisconnect();
-    pj_timer_heap_destroy(timerHeap);
-    pj_ioqueue_destroy(ioqueue);
-    pjmedia_endpt_destroy2(mediaEndpoint);
+    {
+      /// Waits for a task running on another worker, the ones still queued see the strand closed
+      std::lock_guard<std::recursive_mutex> lock(strand->mutex);
+      if(!closed && eventLoop) handleDisconnect();
+      strand->close();
+    }
+    auto& processMetrics = peerConnectionMetrics();
+    PeerConnectionMetrics::move(processMetrics.connectionStates, connectionState, "");
+    PeerConnectionMetrics::move(processMetrics.iceConnectionStates, iceConnectionState, "");
+    PeerConnectionMetrics::move(processMetrics.dtlsStates, dtlsState, "");
+    processMetrics.connections->add(-1);
     pj_pool_release(pool);
   }
 
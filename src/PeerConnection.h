@@ -5,16 +5,45 @@
 #ifndef PJWEBRTC_PEERCONNECTION_H
 #define PJWEBRTC_PEERCONNECTION_H
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include "UserMedia.h"
+#include "EventLoop.h"
+#include "MediaEngine.h"
+#include "BundleTransport.h"
+#include "IceCandidate.h"
+#include "MuxTransport.h"
+#include "SdpWriter.h"
+#include "SessionDescription.h"
+#include "Stats.h"
+#include "Strand.h"
+#include "Metrics.h"
+#include "UdpMux.h"
 #include "global.h"
 #include "Promise.h"
+#include "Coroutine.h"
 #include <json.hpp>
 
 namespace webrtc {
 
   struct PeerConnectionConfiguration {
     nlohmann::json iceServers;
+    /// gatherIceCandidates() resolves after this time even if servers are still gathering, which is what the
+    /// pool waits on to call a connection warmed up. 0 resolves only when every server finished
+    int iceGatheringDeadlineMsec = 0;
+    /// Connection fails and releases its transports when DTLS is not up this long after transport start,
+    /// 0 waits forever
+    int connectTimeoutMsec = 0;
+    /// "balanced" and "max-bundle" put all m-lines on one transport, "max-compat" uses one per m-line
+    std::string bundlePolicy = "balanced";
+    /// Server mode: ICE-lite on this shared port instead of a socket and full ICE agent per connection
+    std::shared_ptr<UdpMux> udpMux;
+    /// Public address servers: a=ice-lite, host candidate only, no gathering, checks are just answered
+    bool iceLite = false;
+    /// Port of the mux lite connections on the same event loop share when udpMux is not set,
+    /// taken from whichever of them comes first
+    UdpMuxConfiguration iceLiteMux;
   };
 
   struct MediaTransport {
@@ -24,13 +53,15 @@ namespace webrtc {
   };
 
   struct MediaStream {
+    pjmedia_transport* transport; /* srtp, or bundle member when m-lines share it */
     pjmedia_stream* stream;
     pjmedia_port* mediaPort;
     pjmedia_snd_port* soundPort;
   };
 
-  class PeerConnection {
+  class PeerConnection : public std::enable_shared_from_this<PeerConnection> {
   private:
+    std::shared_ptr<MediaEngine> mediaEngine;
     pjmedia_endpt *mediaEndpoint;
     std::vector<MediaTransport> mediaTransport; /* Media stream transport	*/
     int mediaTransportsIceInitializedCount;
@@ -39,51 +70,101 @@ namespace webrtc {
     pj_pool_t* pool;
 
     std::vector<MediaStream> mediaStreams;
+    std::unique_ptr<BundleGroup> bundleGroup;
+    std::vector<std::string> localMids;
+
+    bool isBundled();
+    int getTransportsCount(int mediaCount);
+    int getTransportIndex(int mLineIndex);
+    /// a=mid on every m-line, with bundle also the group and the MID header extension when midExtensionId is set
+    void addMediaIds(pjmedia_sdp_session* sdp, bool bundle, int midExtensionId);
+    SdpWriter sdpWriter;
 
     pjmedia_srtp_setting srtpSetting;
 
     std::vector<std::shared_ptr<UserMedia>> inputStreams;
 
     std::shared_ptr<promise::Promise<bool>> iceCompletePromise;
+    std::atomic<bool> iceCompleteSignalled;
+    bool signalIceComplete(); /* false when already signalled */
+
+    TimingWheelEntry gatheringDeadlineEntry;
+    void handleIceGatheringDeadline();
+    friend void gatheringWheelCb(TimingWheelEntry* entry);
     std::shared_ptr<promise::Promise<bool>> dtlsCompletePromise;
+    unsigned long connectTimeoutId; /* strand timeout, 0 when not armed */
+    void handleConnectTimeout();
 
+    /* Null when SdpWriter can't print the description */
     nlohmann::json doCreateOffer();
-    nlohmann::json doCreateAnswer(nlohmann::json offer);
-
-    nlohmann::json localDescription;
-    nlohmann::json remoteDescription;
+    nlohmann::json doCreateAnswer();
 
-    std::string localWithIce;
-    std::string remoteWithIce;
+    std::shared_ptr<SessionDescription> localDescription;
+    std::shared_ptr<SessionDescription> remoteDescription;
+    /* Last offer/answer handed out, until it comes back through setLocalDescription. Its text stays in sdpWriter */
+    std::shared_ptr<SessionDescription> generatedDescription;
 
-    pjmedia_sdp_session *localSdp;
+    pjmedia_sdp_session *localSdp; /* Parsed descriptions of the running session */
     pjmedia_sdp_session *remoteSdp;
 
-    std::vector<nlohmann::json> remoteCandidates;
+    std::mutex localCandidatesMutex;
+    std::vector<IceCandidate> pendingLocalCandidates; /* Gathered, not yet emitted */
+    bool localCandidatesGathered;
+    bool localCandidatesEnded;
+    std::string localIceUfrag;
+
+    void emitLocalCandidates();
+
+    std::vector<IceCandidate> remoteCandidates; /* Received, not yet passed to ICE */
     bool remoteCandidatesGathered;
-    std::shared_ptr<promise::Promise<bool>> remoteIceCompletePromise;
+    void updateRemoteCandidates();
+    /// sdpMLineIndex, or the m-line carrying sdpMid in the remote description, -1 when neither is known
+    int findMLineIndex(const IceCandidate& candidate);
 
     bool sdpGenerated;
     bool transportStarted;
 
     void startTransportIfPossible();
+    void trickleRemoteCandidates();
     void startMedia();
 
-    pj_timer_entry statTimerEntry;
+    TimingWheelEntry statsEntry; /* every second once media started */
 
     void readStats();
-    void scheduleReadStats(int secs, int msecs);
 
-    friend void  statTimerCb(pj_timer_heap_t *ht, pj_timer_entry *e);
+    friend void statsWheelCb(TimingWheelEntry* entry);
 
     void addIceServer(std::string& url, std::string username, std::string password);
 
     void handleDisconnect();
     bool closed;
 
-    unsigned int lastRtpTs;
+    /* Filled by startMedia, arrays stay put once statsStreamsCount is published */
+    std::unique_ptr<MediaStreamCounters[]> streamCounters;
+    std::unique_ptr<TransportCounters[]> transportCounters;
+    int statsTransportsCount;
+    std::atomic<int> statsStreamsCount;
+
+    void publishStatsTransports();
+
+    /* State changes go through these, they keep the process state gauges in step */
+    std::string dtlsState;
+    void setIceConnectionState(const char* state);
+    void setConnectionState(const char* state);
+    void setDtlsState(const char* state);
+
+    /* Setup phases on the monotonic clock, marking one also times the stages it ends */
+    SetupTimeline setupTimeline;
+    int mediaTransportsIceNegotiatedCount;
+    void markPhase(SetupPhase phase);
+
+    static std::atomic<unsigned long> lastId;
 
   public:
+    std::shared_ptr<EventLoop> eventLoop;
+    /// Everything this connection does runs under strand->mutex, public methods take it themselves and
+    /// transport callbacks are posted to it, so any thread may call in with any number of loop workers
+    std::shared_ptr<Strand> strand;
     pj_ioqueue_t* ioqueue;
     pj_timer_heap_t* timerHeap;
 
@@ -98,30 +179,60 @@ namespace webrtc {
     std::function<void(std::string)> onSignalingStateChange;
 
 
-    std::vector<nlohmann::json> localCandidates;
+    std::vector<IceCandidate> localCandidates;
+    /// Called per gathered candidate once local description is set, with nullptr after the last one
+    std::function<void(const IceCandidate*)> onIceCandidate;
 
     PeerConnectionConfiguration configuration;
 
+    /// How many times, process-wide, the gathering promise was resolved by the deadline
+    static std::atomic<unsigned long> iceGatheringDeadlineHits;
+
     PeerConnection();
     ~PeerConnection();
 
-    void init(PeerConnectionConfiguration& configurationp);
+    void init(std::shared_ptr<EventLoop> eventLoopp, std::shared_ptr<MediaEngine> mediaEnginep,
+              PeerConnectionConfiguration& configurationp);
 
     void addStream(std::shared_ptr<UserMedia> userMedia);
     std::shared_ptr<promise::Promise<bool>> gatherIceCandidates(int streamsCount);
 
 
+    /// Candidates are always trickled, descriptions go out without waiting for gathering
     std::shared_ptr<promise::Promise<nlohmann::json>> createOffer();
     std::shared_ptr<promise::Promise<nlohmann::json>> createAnswer();
+#if PROMISE_HAS_COROUTINES
+    /// Offer when remoteOffer is null, answer to it otherwise. signal gets the description before it is set
+    /// locally, so trickled candidates can't overtake it. Resolves once DTLS is up, rejected when the connection
+    /// times out or is closed first.
+    std::shared_ptr<promise::Promise<bool>> negotiate(nlohmann::json remoteOffer,
+                                                      std::function<void(const nlohmann::json&)> signal);
+#endif
     void setLocalDescription(nlohmann::json sdp);
     void setRemoteDescription(nlohmann::json sdp);
 
+    /// Signalling form, null or an empty candidate marks the end of remote candidates
     void addIceCandidate(nlohmann::json candidate);
+    void addIceCandidate(const IceCandidate& candidate);
 
     void close();
 
-   /// callbacks:
+    /// Typed snapshot of the counters readStats last published, lock-free, callable from any thread
+    PeerConnectionStats getStats() const;
+    /// Process-wide setup phase percentiles, over every connection since start
+    static SetupStats getSetupStats();
+    /// This connection's setup as a Chrome trace-event document, loads in chrome://tracing or Perfetto
+    nlohmann::json getSetupTrace() const;
+    /// Adds the events to a traceEvents array, so many connections can go in one trace, one row each
+    void appendSetupTrace(nlohmann::json& traceEvents) const;
+
+    /// Process-unique, the trace thread id of this connection
+    unsigned long id;
+
+   /// callbacks, run on the strand:
     void handleIceTransportComplete(pjmedia_transport *pTransport);
+    void handleIceNewCandidate(pjmedia_transport *pTransport, const IceCandidate& candidate);
+    void handleIceNegotiationComplete(pjmedia_transport *pTransport, pj_status_t status);
     void handleDtlsTransportComplete(pjmedia_transport *pTransport);
   };
 
@@ -0,0 +1,144 @@
+#include "PeerConnectionPool.h"
+#include <algorithm>
+
+namespace webrtc {
+
+  std::atomic<unsigned long> PeerConnectionPool::lastId(0);
+
+  static const char* functionMetrics[] = { "pjwebrtc_pool_hits_total", "pjwebrtc_pool_misses_total",
+                                           "pjwebrtc_pool_warm_up_timeouts_total", "pjwebrtc_pool_ready",
+                                           "pjwebrtc_pool_warming" };
+
+  PeerConnectionPool::PeerConnectionPool() {
+    refillScheduled = false;
+    hits = 0;
+    misses = 0;
+    warmUpTimeouts = 0;
+  }
+
+  void PeerConnectionPool::init(std::shared_ptr<EventLoop> eventLoopp, std::shared_ptr<MediaEngine> mediaEnginep,
+                                PeerConnectionPoolConfiguration& configurationp) {
+    eventLoop = eventLoopp;
+    mediaEngine = mediaEnginep;
+    configuration = configurationp;
+
+    /// Readers use this directly, the destructor unregisters them and removal waits for a running scrape
+    if(metricLabels.empty()) metricLabels = "pool=\"" + std::to_string(++lastId) + "\"";
+    metrics.counterFunction(functionMetrics[0], "Connections handed out already warmed up",
+                            [this]() { return (double)hits.load(); }, metricLabels);
+    metrics.counterFunction(functionMetrics[1], "Connections created on demand, pool was empty",
+                            [this]() { return (double)misses.load(); }, metricLabels);
+    metrics.counterFunction(functionMetrics[2], "Pooled connections dropped while gathering",
+                            [this]() { return (double)warmUpTimeouts.load(); }, metricLabels);
+    metrics.gaugeFunction(functionMetrics[3], "Pooled connections ready to be handed out",
+                          [this]() { return (double)readyCount(); }, metricLabels);
+    metrics.gaugeFunction(functionMetrics[4], "Pooled connections still gathering",
+                          [this]() { return (double)warmingCount(); }, metricLabels);
+
+    scheduleRefill();
+  }
+
+  std::shared_ptr<PeerConnection> PeerConnectionPool::createConnection() {
+    auto pc = std::make_shared<PeerConnection>();
+    pc->init(eventLoop, mediaEngine, configuration.connectionConfiguration);
+    return pc;
+  }
+
+  std::shared_ptr<PeerConnection> PeerConnectionPool::acquire() {
+    std::shared_ptr<PeerConnection> pc;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!ready.empty()) {
+        pc = ready.front();
+        ready.pop_front();
+      }
+    }
+    scheduleRefill();
+    if(pc) {
+      hits++;
+      return pc;
+    }
+    misses++;
+    return createConnection();
+  }
+
+  void PeerConnectionPool::scheduleRefill() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(refillScheduled || ready.size() + warming.size() >= configuration.size) return;
+    refillScheduled = true;
+    /* Transports are created on a loop thread, not on the thread that asked for a connection */
+    std::weak_ptr<PeerConnectionPool> weakPool = shared_from_this();
+    eventLoop->execute([weakPool]() {
+      auto pcPool = weakPool.lock();
+      if(pcPool) pcPool->refill();
+    });
+  }
+
+  void PeerConnectionPool::refill() {
+    int missing;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      refillScheduled = false;
+      missing = configuration.size - (int)(ready.size() + warming.size());
+    }
+    std::weak_ptr<PeerConnectionPool> weakPool = shared_from_this();
+    for(int i = 0; i < missing; i++) {
+      auto pc = createConnection();
+      std::weak_ptr<PeerConnection> weakPc = pc;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        warming.push_back(pc);
+      }
+      pc->gatherIceCandidates(configuration.streamsCount)->onResolved([weakPool, weakPc](bool& ok) {
+        auto pcPool = weakPool.lock();
+        auto pc = weakPc.lock();
+        if(pcPool && pc) pcPool->handleWarmedUp(pc);
+      });
+      /// Gathering may never resolve, a TURN server that doesn't answer keeps it going
+      if(configuration.warmUpTimeoutMsec > 0) eventLoop->setTimeout([weakPool, weakPc]() {
+        auto pcPool = weakPool.lock();
+        auto pc = weakPc.lock();
+        if(pcPool && pc) pcPool->handleWarmUpTimeout(pc);
+      }, configuration.warmUpTimeoutMsec);
+    }
+  }
+
+  void PeerConnectionPool::handleWarmedUp(std::shared_ptr<PeerConnection> pc) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto it = warming.begin(); it != warming.end(); it++) {
+      if(*it != pc) continue;
+      ready.push_back(*it);
+      warming.erase(it);
+      return;
+    }
+  }
+
+  void PeerConnectionPool::handleWarmUpTimeout(std::shared_ptr<PeerConnection> pc) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = std::find(warming.begin(), warming.end(), pc);
+      if(it == warming.end()) return; // warmed up or handed out
+      warming.erase(it);
+    }
+    printf("POOLED CONNECTION STILL GATHERING AFTER %d MS, REPLACING IT\n", configuration.warmUpTimeoutMsec);
+    warmUpTimeouts++;
+    scheduleRefill();
+    /* Last reference is the timeout task's, transports are released when it ends */
+  }
+
+  int PeerConnectionPool::readyCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ready.size();
+  }
+
+  int PeerConnectionPool::warmingCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return warming.size();
+  }
+
+  PeerConnectionPool::~PeerConnectionPool() {
+    if(metricLabels.empty()) return;
+    for(auto name : functionMetrics) metrics.removeFunction(name, metricLabels);
+  }
+
+}
@@ -0,0 +1,63 @@
+#ifndef PJWEBRTC_PEERCONNECTIONPOOL_H
+#define PJWEBRTC_PEERCONNECTIONPOOL_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "PeerConnection.h"
+
+namespace webrtc {
+
+  struct PeerConnectionPoolConfiguration {
+    int size = 4;
+    int streamsCount = 1;
+    /// Connections still gathering after this long are dropped and replaced, 0 waits forever
+    int warmUpTimeoutMsec = 10000;
+    PeerConnectionConfiguration connectionConfiguration;
+  };
+
+  /// Keeps connections with transports created and ICE candidates gathered, ready to be handed out.
+  /// Counters are exported with a pool="<id>" label, so pools can coexist.
+  class PeerConnectionPool : public std::enable_shared_from_this<PeerConnectionPool> {
+  private:
+    std::mutex mutex;
+    std::deque<std::shared_ptr<PeerConnection>> ready;
+    std::vector<std::shared_ptr<PeerConnection>> warming;
+
+    bool refillScheduled;
+    std::string metricLabels;
+    static std::atomic<unsigned long> lastId;
+
+    std::shared_ptr<PeerConnection> createConnection();
+    void scheduleRefill();
+    void refill();
+    void handleWarmedUp(std::shared_ptr<PeerConnection> pc);
+    void handleWarmUpTimeout(std::shared_ptr<PeerConnection> pc);
+
+  public:
+    std::shared_ptr<EventLoop> eventLoop;
+    std::shared_ptr<MediaEngine> mediaEngine;
+
+    PeerConnectionPoolConfiguration configuration;
+
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> warmUpTimeouts;
+
+    PeerConnectionPool();
+    ~PeerConnectionPool();
+
+    void init(std::shared_ptr<EventLoop> eventLoopp, std::shared_ptr<MediaEngine> mediaEnginep,
+              PeerConnectionPoolConfiguration& configurationp);
+
+    /// Returns a warmed up connection if one is ready, a fresh one otherwise. Never waits for gathering.
+    std::shared_ptr<PeerConnection> acquire();
+
+    int readyCount();
+    int warmingCount();
+  };
+
+}
+
+#endif //PJWEBRTC_PEERCONNECTIONPOOL_H
@@ -0,0 +1,64 @@
+#include "SdpWriter.h"
+#include <algorithm>
+#include <cstring>
+
+namespace webrtc {
+
+  static const int SDP_BUFFER_SIZE = 10240;
+  /// pjmedia_sdp_print fails the same way whatever went wrong, so growth has to stop somewhere
+  static const int SDP_MAX_SIZE = 65536;
+
+  static void insertAttribute(unsigned* count, pjmedia_sdp_attr** attributes, unsigned index, pjmedia_sdp_attr* attr) {
+    if(*count >= PJMEDIA_MAX_SDP_ATTR) return;
+    for(unsigned i = *count; i > index; i--) attributes[i] = attributes[i-1];
+    attributes[index] = attr;
+    (*count)++;
+  }
+
+  static void addTrickleOption(pj_pool_t* pool, unsigned* count, pjmedia_sdp_attr** attributes) {
+    if(pjmedia_sdp_attr_find2(*count, attributes, "ice-options", nullptr)) return;
+    for(unsigned i = 0; i < *count; i++) {
+      if(pj_strcmp2(&attributes[i]->name, "ice-pwd") != 0) continue;
+      pj_str_t trickle = pj_str((char*)"trickle");
+      insertAttribute(count, attributes, i + 1, pjmedia_sdp_attr_create(pool, "ice-options", &trickle));
+      return;
+    }
+  }
+
+  SdpWriter::SdpWriter() {
+    buffer.resize(SDP_BUFFER_SIZE);
+    writtenSize = -1;
+  }
+
+  void SdpWriter::prepare(pj_pool_t* pool, pjmedia_sdp_session* sdp) {
+    addTrickleOption(pool, &sdp->attr_count, sdp->attr);
+    /* Session level ice-options covers every m-line */
+    bool sessionOptions = pjmedia_sdp_attr_find2(sdp->attr_count, sdp->attr, "ice-options", nullptr) != nullptr;
+    for(unsigned i = 0; i < sdp->media_count; i++) {
+      pjmedia_sdp_media* media = sdp->media[i];
+      /// Local candidates are trickled from the gathering callbacks, see PeerConnection::handleIceNewCandidate
+      pjmedia_sdp_media_remove_all_attr(media, "candidate");
+      if(!sessionOptions) addTrickleOption(pool, &media->attr_count, media->attr);
+    }
+  }
+
+  std::string SdpWriter::write(const pjmedia_sdp_session* sdp) {
+    int size;
+    while((size = pjmedia_sdp_print(sdp, buffer.data(), buffer.size())) < 0) {
+      if(buffer.size() >= SDP_MAX_SIZE) {
+        printf("SDP DOES NOT PRINT IN %d BYTES\n", SDP_MAX_SIZE);
+        writtenSize = -1;
+        return std::string();
+      }
+      buffer.resize(std::min<std::size_t>(buffer.size() * 2, SDP_MAX_SIZE));
+    }
+    writtenSize = size;
+    return std::string(buffer.data(), size);
+  }
+
+  bool SdpWriter::wrote(const std::string& text) const {
+    return writtenSize >= 0 && text.size() == (std::size_t)writtenSize
+           && std::memcmp(text.data(), buffer.data(), writtenSize) == 0;
+  }
+
+}
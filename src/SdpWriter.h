@@ -0,0 +1,30 @@
+#ifndef PJWEBRTC_SDPWRITER_H
+#define PJWEBRTC_SDPWRITER_H
+
+#include <string>
+#include <vector>
+#include "global.h"
+
+namespace webrtc {
+
+  /// Turns a generated pjmedia_sdp_session into the text handed to the application, edits are made on the structure.
+  class SdpWriter {
+  private:
+    std::vector<char> buffer;
+    int writtenSize; /* of the last write() in buffer, -1 when it failed */
+
+  public:
+    SdpWriter();
+
+    /// Drops candidate lines, they are trickled, and adds ice-options:trickle after ice-pwd when not present
+    void prepare(pj_pool_t* pool, pjmedia_sdp_session* sdp);
+    /// Prints into the reused buffer, grows it only when the description does not fit, up to 64 KB.
+    /// Empty when it can't be printed.
+    std::string write(const pjmedia_sdp_session* sdp);
+    /// True when text is what the last write() returned, compared against the buffer so no copy is kept
+    bool wrote(const std::string& text) const;
+  };
+
+}
+
+#endif //PJWEBRTC_SDPWRITER_H
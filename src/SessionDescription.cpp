@@ -0,0 +1,34 @@
+#include "SessionDescription.h"
+
+namespace webrtc {
+
+  SessionDescription::SessionDescription(const std::string& typep, pjmedia_sdp_session* sdpp) {
+    type = typep;
+    sdp = sdpp;
+  }
+
+  std::shared_ptr<SessionDescription> SessionDescription::parse(pj_pool_t* pool, const nlohmann::json& description) {
+    auto typeIt = description.find("type");
+    auto sdpIt = description.find("sdp");
+    if(typeIt == description.end() || sdpIt == description.end() || !sdpIt->is_string()) return nullptr;
+    const std::string& text = sdpIt->get_ref<const std::string&>();
+
+    /// Parsed attributes point into the text, so it goes to the pool and the json can be dropped
+    char* buffer = (char*)pj_pool_alloc(pool, text.size() + 1);
+    pj_memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = 0;
+    pjmedia_sdp_session* sdp;
+    if(pjmedia_sdp_parse(pool, buffer, text.size(), &sdp) != PJ_SUCCESS) return nullptr;
+    return std::make_shared<SessionDescription>(typeIt->get<std::string>(), sdp);
+  }
+
+  void SessionDescription::addCandidate(pj_pool_t* pool, const IceCandidate& candidate) {
+    if(candidate.sdpMLineIndex < 0 || candidate.sdpMLineIndex >= sdp->media_count) return;
+    std::string value = candidate.toAttribute();
+    pj_str_t valueString = pj_str((char*)value.c_str());
+    /* attribute value is duplicated into the pool */
+    pjmedia_sdp_media_add_attr(sdp->media[candidate.sdpMLineIndex],
+                               pjmedia_sdp_attr_create(pool, "candidate", &valueString));
+  }
+
+}
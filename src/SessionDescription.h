@@ -0,0 +1,29 @@
+#ifndef PJWEBRTC_SESSIONDESCRIPTION_H
+#define PJWEBRTC_SESSIONDESCRIPTION_H
+
+#include <memory>
+#include <string>
+#include "IceCandidate.h"
+#include "global.h"
+#include <json.hpp>
+
+namespace webrtc {
+
+  /// Offer or answer parsed once into the connection pool, shared by negotiation, transport and media start.
+  class SessionDescription {
+  public:
+    std::string type;
+    pjmedia_sdp_session* sdp;
+
+    SessionDescription(const std::string& typep, pjmedia_sdp_session* sdpp);
+
+    /// {"type", "sdp"} as exchanged with the application, nullptr when the text is not valid SDP
+    static std::shared_ptr<SessionDescription> parse(pj_pool_t* pool, const nlohmann::json& description);
+
+    /// Adds a=candidate to the candidate's m-line
+    void addCandidate(pj_pool_t* pool, const IceCandidate& candidate);
+  };
+
+}
+
+#endif //PJWEBRTC_SESSIONDESCRIPTION_H
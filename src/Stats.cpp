@@ -0,0 +1,190 @@
+#include <chrono>
+#include "Stats.h"
+
+namespace webrtc {
+
+  static const char* setupPhaseNames[] = {
+      "created", "streamAdded", "gatheringStarted", "gatheringComplete", "offerCreated", "answerCreated",
+      "localDescriptionSet", "remoteDescriptionSet", "transportStarted", "checksComplete", "dtlsComplete",
+      "mediaStarted", "firstRtp", "closed"
+  };
+
+  struct SetupStageSpan {
+    const char* name;
+    SetupPhase from;
+    SetupPhase fallbackFrom; /* when from is never reached on this path */
+    SetupPhase to;
+  };
+
+  static const SetupStageSpan setupStageSpans[] = {
+      {"iceGathering", SetupPhase::GatheringStarted, SetupPhase::GatheringStarted, SetupPhase::GatheringComplete},
+      {"negotiation", SetupPhase::OfferCreated, SetupPhase::RemoteDescriptionSet, SetupPhase::TransportStarted},
+      {"iceChecking", SetupPhase::TransportStarted, SetupPhase::TransportStarted, SetupPhase::ChecksComplete},
+      {"dtlsHandshake", SetupPhase::ChecksComplete, SetupPhase::TransportStarted, SetupPhase::DtlsComplete},
+      {"mediaStart", SetupPhase::DtlsComplete, SetupPhase::DtlsComplete, SetupPhase::MediaStarted},
+      {"firstRtp", SetupPhase::MediaStarted, SetupPhase::MediaStarted, SetupPhase::FirstRtp}
+  };
+
+  const char* setupPhaseName(SetupPhase phase) {
+    return setupPhaseNames[(int)phase];
+  }
+
+  const char* setupStageName(SetupStage stage) {
+    return setupStageSpans[(int)stage].name;
+  }
+
+  SetupTimeline::SetupTimeline() {
+    for(auto& time : times) time.store(0, std::memory_order_relaxed);
+  }
+
+  pj_int64_t SetupTimeline::now() {
+    auto sinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count();
+  }
+
+  bool SetupTimeline::mark(SetupPhase phase) {
+    pj_int64_t unset = 0;
+    return times[(int)phase].compare_exchange_strong(unset, now(), std::memory_order_relaxed);
+  }
+
+  pj_int64_t SetupTimeline::time(SetupPhase phase) const {
+    return times[(int)phase].load(std::memory_order_relaxed);
+  }
+
+  pj_int64_t SetupTimeline::duration(SetupStage stage) const {
+    const SetupStageSpan& span = setupStageSpans[(int)stage];
+    pj_int64_t from = time(span.from);
+    if(!from) from = time(span.fallbackFrom);
+    pj_int64_t to = time(span.to);
+    if(!from || !to || to < from) return -1;
+    return to - from;
+  }
+
+  std::vector<SetupStage> SetupTimeline::stagesEndingAt(SetupPhase phase) {
+    std::vector<SetupStage> stages;
+    for(int i = 0; i < (int)SetupStage::Count; i++) {
+      if(setupStageSpans[i].to == phase) stages.push_back((SetupStage)i);
+    }
+    return stages;
+  }
+
+  void SetupTimeline::appendTraceEvents(nlohmann::json& events, int pid, unsigned long tid) const {
+    for(int i = 0; i < (int)SetupStage::Count; i++) {
+      pj_int64_t stageDuration = duration((SetupStage)i);
+      if(stageDuration < 0) continue;
+      const SetupStageSpan& span = setupStageSpans[i];
+      pj_int64_t start = time(span.to) - stageDuration;
+      events.push_back({{"name", span.name}, {"cat", "setup"}, {"ph", "X"},
+                        {"ts", start}, {"dur", stageDuration}, {"pid", pid}, {"tid", tid}});
+    }
+    for(int i = 0; i < (int)SetupPhase::Count; i++) {
+      pj_int64_t phaseTime = time((SetupPhase)i);
+      if(!phaseTime) continue;
+      events.push_back({{"name", setupPhaseNames[i]}, {"cat", "setup"}, {"ph", "i"}, {"s", "t"},
+                        {"ts", phaseTime}, {"pid", pid}, {"tid", tid}});
+    }
+  }
+
+  MediaStreamCounters::MediaStreamCounters()
+      : ssrc(0), transportIndex(0), remoteSsrc(0), packetsReceived(0), bytesReceived(0), packetsLost(0),
+        packetsDuplicated(0), packetsReordered(0), jitterUsec(0), lastPacketReceivedMsec(0),
+        packetsSent(0), bytesSent(0), remotePacketsLost(0), remoteJitterUsec(0), roundTripTimeUsec(0),
+        lossPeriodsSeen(0), lastRtpTs(0) {
+    codec.payloadType = 0;
+    codec.clockRate = 0;
+    codec.channels = 0;
+  }
+
+  TransportCounters::TransportCounters() : valid(false), dtlsState("new") {
+  }
+
+  LatencySummary LatencySummary::of(const HdrHistogram& histogram) {
+    LatencySummary summary;
+    summary.count = histogram.count();
+    summary.p50 = histogram.percentile(0.5) / 1000000.0;
+    summary.p99 = histogram.percentile(0.99) / 1000000.0;
+    summary.p999 = histogram.percentile(0.999) / 1000000.0;
+    summary.max = histogram.max() / 1000000.0;
+    return summary;
+  }
+
+  nlohmann::json LatencySummary::toJson() const {
+    return {{"count", count}, {"p50", p50}, {"p99", p99}, {"p999", p999}, {"max", max}};
+  }
+
+  nlohmann::json SetupStats::toJson() const {
+    return {
+        {"iceGathering", iceGathering.toJson()},
+        {"negotiation", negotiation.toJson()},
+        {"iceChecking", iceChecking.toJson()},
+        {"dtlsHandshake", dtlsHandshake.toJson()},
+        {"mediaStart", mediaStart.toJson()},
+        {"firstRtp", firstRtp.toJson()}
+    };
+  }
+
+  nlohmann::json PeerConnectionStats::toJson() const {
+    nlohmann::json report = nlohmann::json::object();
+    for(auto& codec : codecs) {
+      report[codec.id] = {
+          {"id", codec.id}, {"type", "codec"}, {"timestamp", timestamp},
+          {"payloadType", codec.payloadType}, {"mimeType", codec.mimeType},
+          {"clockRate", codec.clockRate}, {"channels", codec.channels}
+      };
+    }
+    for(auto& stream : inboundRtp) {
+      report[stream.id] = {
+          {"id", stream.id}, {"type", "inbound-rtp"}, {"timestamp", timestamp},
+          {"kind", stream.kind}, {"mid", stream.mid}, {"ssrc", stream.ssrc},
+          {"codecId", stream.codecId}, {"transportId", stream.transportId},
+          {"packetsReceived", stream.packetsReceived}, {"bytesReceived", stream.bytesReceived},
+          {"packetsLost", stream.packetsLost}, {"packetsDuplicated", stream.packetsDuplicated},
+          {"packetsReordered", stream.packetsReordered}, {"jitter", stream.jitter},
+          {"jitterDistribution", stream.jitterDistribution.toJson()},
+          {"lossPeriodDistribution", stream.lossPeriodDistribution.toJson()},
+          {"lastPacketReceivedTimestamp", stream.lastPacketReceivedTimestamp}
+      };
+    }
+    for(auto& stream : outboundRtp) {
+      report[stream.id] = {
+          {"id", stream.id}, {"type", "outbound-rtp"}, {"timestamp", timestamp},
+          {"kind", stream.kind}, {"mid", stream.mid}, {"ssrc", stream.ssrc},
+          {"codecId", stream.codecId}, {"transportId", stream.transportId},
+          {"packetsSent", stream.packetsSent}, {"bytesSent", stream.bytesSent},
+          {"remotePacketsLost", stream.remotePacketsLost}, {"remoteJitter", stream.remoteJitter},
+          {"roundTripTime", stream.roundTripTime},
+          {"roundTripTimeDistribution", stream.roundTripTimeDistribution.toJson()}
+      };
+    }
+    for(auto& pair : candidatePairs) {
+      report[pair.id] = {
+          {"id", pair.id}, {"type", "candidate-pair"}, {"timestamp", timestamp},
+          {"transportId", pair.transportId},
+          {"localCandidateType", pair.localCandidateType}, {"localAddress", pair.localAddress},
+          {"remoteCandidateType", pair.remoteCandidateType}, {"remoteAddress", pair.remoteAddress},
+          {"state", pair.state}, {"nominated", pair.nominated},
+          {"bytesSent", pair.bytesSent}, {"bytesReceived", pair.bytesReceived},
+          {"currentRoundTripTime", pair.currentRoundTripTime}
+      };
+    }
+    for(auto& transport : transports) {
+      report[transport.id] = {
+          {"id", transport.id}, {"type", "transport"}, {"timestamp", timestamp},
+          {"dtlsState", transport.dtlsState}, {"selectedCandidatePairId", transport.selectedCandidatePairId},
+          {"bytesSent", transport.bytesSent}, {"bytesReceived", transport.bytesReceived}
+      };
+    }
+    if(!setupPhases.empty()) {
+      nlohmann::json phases = nlohmann::json::object();
+      for(auto& phase : setupPhases) phases[phase.name] = phase.time;
+      nlohmann::json stages = nlohmann::json::object();
+      for(auto& stage : setupStages) stages[stage.name] = stage.duration;
+      report["setup"] = {
+          {"id", "setup"}, {"type", "setup"}, {"timestamp", timestamp},
+          {"phases", phases}, {"stages", stages}
+      };
+    }
+    return report;
+  }
+
+}
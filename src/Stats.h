@@ -0,0 +1,227 @@
+#ifndef PJWEBRTC_STATS_H
+#define PJWEBRTC_STATS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "global.h"
+#include "HdrHistogram.h"
+#include <json.hpp>
+
+namespace webrtc {
+
+  enum class SetupPhase : int {
+    Created, StreamAdded, GatheringStarted, GatheringComplete, OfferCreated, AnswerCreated,
+    LocalDescriptionSet, RemoteDescriptionSet, TransportStarted, ChecksComplete, DtlsComplete,
+    MediaStarted, FirstRtp, Closed,
+    Count
+  };
+
+  /// Spans between two phases, what the trace draws and the process histograms time
+  enum class SetupStage : int {
+    IceGathering, Negotiation, IceChecking, DtlsHandshake, MediaStart, FirstRtp,
+    Count
+  };
+
+  const char* setupPhaseName(SetupPhase phase);
+  const char* setupStageName(SetupStage stage);
+
+  /// Monotonic usec at which one connection first reached each phase, 0 when not yet. Lock-free, so
+  /// phases can be marked from pjmedia callbacks and read by stats from any thread.
+  class SetupTimeline {
+  public:
+    std::atomic<pj_int64_t> times[(int)SetupPhase::Count];
+
+    SetupTimeline();
+
+    /// steady_clock usec
+    static pj_int64_t now();
+
+    /// True the first time phase is reached, later marks keep the first time
+    bool mark(SetupPhase phase);
+    pj_int64_t time(SetupPhase phase) const;
+    /// Usec, -1 while either end is missing
+    pj_int64_t duration(SetupStage stage) const;
+    /// Stages whose span ends at phase
+    static std::vector<SetupStage> stagesEndingAt(SetupPhase phase);
+
+    /// Chrome trace-event form: a complete event per stage and an instant event per phase, on thread tid
+    void appendTraceEvents(nlohmann::json& events, int pid, unsigned long tid) const;
+  };
+
+  struct SetupPhaseStats {
+    std::string name;
+    /// Seconds since the connection was created
+    double time;
+  };
+
+  struct SetupStageStats {
+    std::string name;
+    double duration;
+  };
+
+  /* Snapshot types, field names follow the W3C RTCStats dictionaries, times in seconds */
+
+  /// Tail of an HdrHistogram of usec values, in seconds
+  struct LatencySummary {
+    unsigned long count;
+    double p50;
+    double p99;
+    double p999;
+    double max;
+
+    static LatencySummary of(const HdrHistogram& histogram);
+    nlohmann::json toJson() const;
+  };
+
+  struct CodecStats {
+    std::string id;
+    unsigned payloadType;
+    std::string mimeType;
+    unsigned clockRate;
+    unsigned channels;
+  };
+
+  struct InboundRtpStreamStats {
+    std::string id;
+    std::string kind;
+    std::string mid;
+    pj_uint32_t ssrc;
+    std::string codecId;
+    std::string transportId;
+    unsigned long packetsReceived;
+    unsigned long bytesReceived;
+    long packetsLost;
+    unsigned long packetsDuplicated;
+    unsigned long packetsReordered;
+    double jitter;
+    /// Per stats read samples of jitter, and lengths of loss periods
+    LatencySummary jitterDistribution;
+    LatencySummary lossPeriodDistribution;
+    /// Wall clock msec, 0 before the first packet
+    double lastPacketReceivedTimestamp;
+  };
+
+  struct OutboundRtpStreamStats {
+    std::string id;
+    std::string kind;
+    std::string mid;
+    pj_uint32_t ssrc;
+    std::string codecId;
+    std::string transportId;
+    unsigned long packetsSent;
+    unsigned long bytesSent;
+    /// From the remote's receiver reports
+    long remotePacketsLost;
+    double remoteJitter;
+    double roundTripTime;
+    LatencySummary roundTripTimeDistribution;
+  };
+
+  struct IceCandidatePairStats {
+    std::string id;
+    std::string transportId;
+    std::string localCandidateType;
+    std::string localAddress;
+    std::string remoteCandidateType;
+    std::string remoteAddress;
+    std::string state;
+    bool nominated;
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+    double currentRoundTripTime;
+  };
+
+  struct TransportStats {
+    std::string id;
+    std::string dtlsState;
+    std::string selectedCandidatePairId;
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+  };
+
+  struct PeerConnectionStats {
+    /// Wall clock msec of the snapshot
+    double timestamp;
+    std::vector<InboundRtpStreamStats> inboundRtp;
+    std::vector<OutboundRtpStreamStats> outboundRtp;
+    std::vector<IceCandidatePairStats> candidatePairs;
+    std::vector<TransportStats> transports;
+    std::vector<CodecStats> codecs;
+    /// Phases reached so far, in order, and the stages completed between them
+    std::vector<SetupPhaseStats> setupPhases;
+    std::vector<SetupStageStats> setupStages;
+
+    /// RTCStatsReport form, an object of stats keyed by id, each with "type" and "timestamp"
+    nlohmann::json toJson() const;
+  };
+
+  /// Process-wide setup stages over every connection, see setupStageName for what each spans
+  struct SetupStats {
+    /// gatherIceCandidates until every transport finished gathering
+    LatencySummary iceGathering;
+    /// Offer created (remote offer set when answering) until both descriptions are in and transport starts
+    LatencySummary negotiation;
+    /// Transport start until connectivity checks nominated a pair on every transport, full ICE only
+    LatencySummary iceChecking;
+    /// End of checks (transport start for ICE-lite) until DTLS completed on every transport
+    LatencySummary dtlsHandshake;
+    /// DTLS completion until streams and sound ports are running
+    LatencySummary mediaStart;
+    /// Media start until the first stats read that saw RTP, so at stats read resolution
+    LatencySummary firstRtp;
+
+    nlohmann::json toJson() const;
+  };
+
+  /// Counters of one m-line, written by PeerConnection::readStats, read by getStats from any thread.
+  /// Relaxed atomics, a snapshot may mix values of two consecutive updates but never blocks media.
+  struct MediaStreamCounters {
+    /* Set in startMedia before the stream is published, constant afterwards */
+    std::string mid;
+    std::string kind;
+    pj_uint32_t ssrc;
+    int transportIndex;
+    CodecStats codec;
+
+    std::atomic<pj_uint32_t> remoteSsrc;
+    std::atomic<unsigned long> packetsReceived;
+    std::atomic<unsigned long> bytesReceived;
+    std::atomic<long> packetsLost;
+    std::atomic<unsigned long> packetsDuplicated;
+    std::atomic<unsigned long> packetsReordered;
+    std::atomic<unsigned> jitterUsec;
+    std::atomic<pj_int64_t> lastPacketReceivedMsec;
+
+    std::atomic<unsigned long> packetsSent;
+    std::atomic<unsigned long> bytesSent;
+    std::atomic<long> remotePacketsLost;
+    std::atomic<unsigned> remoteJitterUsec;
+    std::atomic<unsigned> roundTripTimeUsec;
+
+    unsigned lossPeriodsSeen; /* readStats only, loss periods already observed in the histograms */
+    pj_uint32_t lastRtpTs; /* readStats only, timestamp of the last RTP packet at the previous read */
+
+    HdrHistogram jitterHistogram;
+    HdrHistogram roundTripTimeHistogram;
+    HdrHistogram lossPeriodHistogram;
+
+    MediaStreamCounters();
+  };
+
+  /// Selected pair of one transport, captured when media starts
+  struct TransportCounters {
+    std::string localCandidateType;
+    std::string localAddress;
+    std::string remoteCandidateType;
+    std::string remoteAddress;
+    bool valid;
+
+    std::atomic<const char*> dtlsState; /* static state name, follows the connection after media started */
+
+    TransportCounters();
+  };
+
+}
+
+#endif //PJWEBRTC_STATS_H
@@ -0,0 +1,37 @@
+#include "Strand.h"
+
+namespace webrtc {
+
+  Strand::Strand() {
+    closed = false;
+  }
+
+  void Strand::init(std::shared_ptr<promise::Executor> executorp) {
+    executor = executorp;
+  }
+
+  void Strand::close() {
+    closed = true;
+  }
+
+  promise::Task Strand::guard(promise::Task task) {
+    auto self = shared_from_this();
+    return [self, task = std::move(task)]() mutable {
+      std::lock_guard<std::recursive_mutex> lock(self->mutex);
+      if(!self->closed) task();
+    };
+  }
+
+  void Strand::execute(promise::Task task) {
+    executor->execute(guard(std::move(task)));
+  }
+
+  unsigned long Strand::setTimeout(promise::Task task, int msec) {
+    return executor->setTimeout(guard(std::move(task)), msec);
+  }
+
+  bool Strand::clearTimeout(unsigned long timeoutId) {
+    return executor->clearTimeout(timeoutId);
+  }
+
+}
@@ -0,0 +1,37 @@
+#ifndef PJWEBRTC_STRAND_H
+#define PJWEBRTC_STRAND_H
+
+#include <memory>
+#include <mutex>
+#include "Executor.h"
+
+namespace webrtc {
+
+  /// Serializes one object's work across the EventLoop workers and the application threads. Application
+  /// calls lock mutex in place. Callbacks that arrive holding pjnath or pjmedia locks post here instead,
+  /// because application calls take those locks after this one. As an Executor it runs every task and timeout
+  /// under mutex and drops them once closed, so a task can outlive the object it was posted for.
+  class Strand : public promise::Executor, public std::enable_shared_from_this<Strand> {
+  private:
+    std::shared_ptr<promise::Executor> executor;
+    bool closed; /* under mutex */
+
+    promise::Task guard(promise::Task task);
+
+  public:
+    std::recursive_mutex mutex;
+
+    Strand();
+
+    void init(std::shared_ptr<promise::Executor> executorp);
+    /// Call under mutex, tasks and timeouts that did not run yet are dropped from now on
+    void close();
+
+    void execute(promise::Task task) override;
+    unsigned long setTimeout(promise::Task task, int msec) override;
+    bool clearTimeout(unsigned long timeoutId) override;
+  };
+
+}
+
+#endif //PJWEBRTC_STRAND_H
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include "TimingWheel.h"
+
+namespace webrtc {
+
+  static const pj_uint64_t slotMask = TimingWheel::slotsCount - 1;
+  static const pj_uint64_t maxDelta = (1ull << (TimingWheel::slotBits * TimingWheel::levelsCount)) - 1;
+
+  static pj_int64_t steadyUsec() {
+    auto sinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count();
+  }
+
+  static void linkBefore(TimingWheelEntry* head, TimingWheelEntry* entry) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+  }
+
+  static void unlink(TimingWheelEntry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = nullptr;
+    entry->next = nullptr;
+  }
+
+  /* Moves every entry of from to the end of to, from is left empty */
+  static void splice(TimingWheelEntry* from, TimingWheelEntry* to) {
+    if(from->next == from) return;
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    from->next = from;
+    from->prev = from;
+  }
+
+  TimingWheelEntry::TimingWheelEntry() {
+    userData = nullptr;
+    cb = nullptr;
+    prev = nullptr;
+    next = nullptr;
+    expires = 0;
+    periodTicks = 0;
+  }
+
+  void TimingWheelEntry::init(void* userDatap, TimingWheelCallback* cbp) {
+    userData = userDatap;
+    cb = cbp;
+  }
+
+  TimingWheel::TimingWheel() : currentTick(0) {
+    tickMsec = 10;
+    startUsec = steadyUsec();
+    count = 0;
+    running = nullptr;
+    for(auto& level : slots) {
+      for(auto& head : level) head.prev = head.next = &head;
+    }
+    due.prev = due.next = &due;
+  }
+
+  void TimingWheel::init(int tickMsecp) {
+    tickMsec = tickMsecp > 0 ? tickMsecp : 1;
+  }
+
+  pj_uint64_t TimingWheel::nowTick() {
+    return (steadyUsec() - startUsec) / (tickMsec * 1000);
+  }
+
+  void TimingWheel::insert(TimingWheelEntry* entry) {
+    pj_uint64_t tick = currentTick.load(std::memory_order_relaxed);
+    if(entry->expires < tick) entry->expires = tick;
+    if(entry->expires - tick > maxDelta) entry->expires = tick + maxDelta;
+    pj_uint64_t delta = entry->expires - tick;
+    int level = 0;
+    while(level < levelsCount - 1 && delta >> (slotBits * (level + 1))) level++;
+    linkBefore(&slots[level][(entry->expires >> (slotBits * level)) & slotMask], entry);
+  }
+
+  void TimingWheel::cascade(int level, int slot) {
+    TimingWheelEntry pending;
+    pending.prev = pending.next = &pending;
+    splice(&slots[level][slot], &pending);
+    while(pending.next != &pending) {
+      TimingWheelEntry* entry = pending.next;
+      unlink(entry);
+      insert(entry);
+    }
+  }
+
+  void TimingWheel::schedule(TimingWheelEntry* entry, int delayMsec, int periodMsec) {
+    pj_int64_t tickUsec = tickMsec * 1000;
+    pj_int64_t deadlineUsec = steadyUsec() - startUsec + (pj_int64_t)delayMsec * 1000;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(entry->next) unlink(entry);
+    else count++;
+    entry->expires = (deadlineUsec + tickUsec - 1) / tickUsec;
+    entry->periodTicks = periodMsec > 0 ? std::max(1, (periodMsec + tickMsec / 2) / tickMsec) : 0;
+    insert(entry);
+  }
+
+  bool TimingWheel::cancel(TimingWheelEntry* entry) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool scheduled = entry->next != nullptr;
+    if(scheduled) {
+      unlink(entry);
+      count--;
+    }
+    if(runningThread != std::this_thread::get_id()) {
+      finished.wait(lock, [this, entry] { return running != entry; });
+    }
+    return scheduled;
+  }
+
+  unsigned long TimingWheel::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
+
+  int TimingWheel::poll() {
+    pj_uint64_t now = nowTick();
+    if(now < currentTick.load(std::memory_order_relaxed)) return 0;
+    std::unique_lock<std::mutex> pollLock(pollMutex, std::try_to_lock);
+    if(!pollLock.owns_lock()) return 0;
+
+    int ran = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(currentTick.load(std::memory_order_relaxed) <= now) {
+      /* Nothing to cascade or run, skip the idle ticks */
+      if(!count) {
+        currentTick.store(now + 1, std::memory_order_relaxed);
+        break;
+      }
+      pj_uint64_t tick = currentTick.load(std::memory_order_relaxed);
+      /// Each time a level wraps, the next slot of the level above is spread over the levels below
+      for(int level = 1; level < levelsCount && !(tick & ((1ull << (slotBits * level)) - 1)); level++) {
+        cascade(level, (tick >> (slotBits * level)) & slotMask);
+      }
+      splice(&slots[0][tick & slotMask], &due);
+      currentTick.store(tick + 1, std::memory_order_relaxed);
+
+      /* Callbacks run unlocked, so they can schedule and cancel, and cancel still reaches the due ones */
+      while(due.next != &due) {
+        TimingWheelEntry* entry = due.next;
+        unlink(entry);
+        if(entry->periodTicks) {
+          /// A wheel polled late skips the periods it missed instead of running them back to back
+          pj_uint64_t period = entry->periodTicks;
+          entry->expires = tick + period;
+          if(entry->expires <= now) entry->expires += ((now - entry->expires) / period + 1) * period;
+          insert(entry);
+        } else {
+          count--;
+        }
+        running = entry;
+        runningThread = std::this_thread::get_id();
+        lock.unlock();
+        entry->cb(entry);
+        ran++;
+        lock.lock();
+        running = nullptr;
+        runningThread = std::thread::id();
+        finished.notify_all();
+      }
+    }
+    return ran;
+  }
+
+}
@@ -0,0 +1,81 @@
+#ifndef PJWEBRTC_TIMINGWHEEL_H
+#define PJWEBRTC_TIMINGWHEEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "global.h"
+
+namespace webrtc {
+
+  struct TimingWheelEntry;
+
+  typedef void TimingWheelCallback(TimingWheelEntry* entry);
+
+  /// Embedded in its owner like a pj_timer_entry, the wheel only links it, nothing is allocated
+  struct TimingWheelEntry {
+    void* userData;
+    TimingWheelCallback* cb;
+
+    /* Owned by the wheel, next is null while not scheduled */
+    TimingWheelEntry* prev;
+    TimingWheelEntry* next;
+    pj_uint64_t expires; /* tick */
+    pj_uint64_t periodTicks; /* 0 for one-shot */
+
+    TimingWheelEntry();
+    void init(void* userDatap, TimingWheelCallback* cbp);
+  };
+
+  /// Hierarchical timing wheel, levels of 64 slots each covering 64 times the span of the one below.
+  /// Schedule and cancel are O(1) list operations, an entry moves down a level at most levelsCount - 1 times.
+  /// Shared by every connection of an EventLoop and advanced from its poll(), so all entries due in one tick
+  /// run in a single batch on one worker, without touching the timer heap.
+  class TimingWheel {
+  public:
+    static constexpr int slotBits = 6;
+    static constexpr int slotsCount = 1 << slotBits;
+    /// 2^24 ticks, about 46 hours at 10 msec, later deadlines are clamped to that
+    static constexpr int levelsCount = 4;
+
+    TimingWheel();
+
+    void init(int tickMsecp);
+
+    /// First run after delayMsec, then every periodMsec unless it is 0. Reschedules a scheduled entry.
+    /// Deadlines round up to the next tick, so an entry never runs early.
+    void schedule(TimingWheelEntry* entry, int delayMsec, int periodMsec = 0);
+    /// False when the entry wasn't scheduled. Waits for its callback when another worker is running it, so the
+    /// owner may be freed once this returns. Called from inside that callback it just unlinks.
+    bool cancel(TimingWheelEntry* entry);
+
+    /// Runs the callbacks of every tick up to now, returns how many ran. Callable from any thread, only one
+    /// advances the wheel at a time, the others return 0 right away.
+    int poll();
+
+    /// Scheduled entries, periodic ones included
+    unsigned long size();
+
+    int tickMsec;
+
+  private:
+    std::mutex mutex;
+    std::mutex pollMutex;
+    std::condition_variable finished; /* a callback returned */
+    TimingWheelEntry* running; /* under mutex, entry whose callback is running */
+    std::thread::id runningThread;
+    TimingWheelEntry slots[levelsCount][slotsCount]; /* list heads */
+    TimingWheelEntry due; /* popped from the wheel, not run yet */
+    pj_int64_t startUsec;
+    std::atomic<pj_uint64_t> currentTick; /* next tick to run */
+    unsigned long count;
+
+    pj_uint64_t nowTick();
+    void insert(TimingWheelEntry* entry);
+    void cascade(int level, int slot);
+  };
+
+}
+
+#endif //PJWEBRTC_TIMINGWHEEL_H
@@ -0,0 +1,333 @@
+#include "UdpMux.h"
+#include "MuxTransport.h"
+#include <algorithm>
+
+#if PJWEBRTC_UDPMUX_MMSG
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
+
+namespace webrtc {
+
+  static const pj_uint32_t STUN_MAGIC_COOKIE = 0x2112A442;
+  static const pj_uint16_t STUN_ATTR_USERNAME = 0x0006;
+
+  AddressKey::AddressKey(const pj_sockaddr* address) {
+    pj_uint16_t port = pj_sockaddr_get_port(address);
+    unsigned addressLength = address->addr.sa_family == pj_AF_INET6() ? 16 : 4;
+    pj_memcpy(bytes, pj_sockaddr_get_addr(address), addressLength);
+    bytes[addressLength] = port >> 8;
+    bytes[addressLength + 1] = port & 0xff;
+    length = addressLength + 2;
+  }
+
+  bool AddressKey::operator==(const AddressKey& other) const {
+    return length == other.length && pj_memcmp(bytes, other.bytes, length) == 0;
+  }
+
+  std::size_t AddressKeyHash::operator()(const AddressKey& key) const {
+    std::size_t hash = 14695981039346656037ULL; // FNV-1a
+    for(int i = 0; i < key.length; i++) {
+      hash ^= key.bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  static bool isStun(const pj_uint8_t* packet, pj_ssize_t size) {
+    if(size < 20 || (packet[0] & 0xC0) != 0) return false;
+    pj_uint32_t cookie;
+    pj_memcpy(&cookie, packet + 4, 4);
+    return pj_ntohl(cookie) == STUN_MAGIC_COOKIE;
+  }
+
+  /// Local part of "local:remote" from the USERNAME attribute, without decoding the whole message
+  static std::string readStunUfrag(const pj_uint8_t* packet, pj_ssize_t size) {
+    pj_ssize_t offset = 20;
+    while(offset + 4 <= size) {
+      pj_uint16_t type = (packet[offset] << 8) | packet[offset+1];
+      pj_uint16_t length = (packet[offset+2] << 8) | packet[offset+3];
+      offset += 4;
+      if(offset + length > size) break;
+      if(type == STUN_ATTR_USERNAME) {
+        const char* value = (const char*)packet + offset;
+        const char* separator = (const char*)memchr(value, ':', length);
+        return std::string(value, separator ? separator - value : length);
+      }
+      offset += (length + 3) & ~3;
+    }
+    return "";
+  }
+
+  static void readOne(UdpMuxSocket* socket, pj_uint8_t* buffer, pj_ssize_t bufferSize) {
+    pj_ssize_t size = bufferSize;
+    pj_sockaddr source;
+    int sourceLength = sizeof(source);
+    if(pj_sock_recvfrom(socket->sock, buffer, &size, 0, &source, &sourceLength) != PJ_SUCCESS) return;
+    socket->mux->receiveCalls++;
+    socket->mux->handlePacket(socket, buffer, size, &source, sourceLength);
+  }
+
+#if PJWEBRTC_UDPMUX_MMSG
+  static const int GRO_SLOT_SIZE = 65536;
+
+  /// Drains up to batchSize datagrams with one recvmmsg, GRO buffers are cut back into the original datagrams
+  static void readBatch(UdpMuxSocket* socket, pj_uint8_t* buffers, int slotSize, mmsghdr* messages,
+                        iovec* vectors, pj_sockaddr* sources, char* controls, int controlSize) {
+    UdpMux* mux = socket->mux;
+    int batchSize = mux->configuration.batchSize;
+    for(int i = 0; i < batchSize; i++) {
+      vectors[i].iov_base = buffers + i * slotSize;
+      vectors[i].iov_len = slotSize;
+      msghdr& header = messages[i].msg_hdr;
+      header.msg_name = &sources[i];
+      header.msg_namelen = sizeof(pj_sockaddr);
+      header.msg_iov = &vectors[i];
+      header.msg_iovlen = 1;
+      header.msg_control = controlSize ? controls + i * controlSize : nullptr;
+      header.msg_controllen = controlSize;
+      header.msg_flags = 0;
+    }
+    int count = recvmmsg(socket->sock, messages, batchSize, MSG_DONTWAIT, nullptr);
+    if(count <= 0) return;
+    mux->receiveCalls++;
+    for(int i = 0; i < count; i++) {
+      pj_uint8_t* packet = buffers + i * slotSize;
+      int length = messages[i].msg_len;
+      int segmentSize = length;
+#ifdef UDP_GRO
+      for(cmsghdr* control = CMSG_FIRSTHDR(&messages[i].msg_hdr); control;
+          control = CMSG_NXTHDR(&messages[i].msg_hdr, control)) {
+        if(control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO)
+          pj_memcpy(&segmentSize, CMSG_DATA(control), sizeof(int));
+      }
+#endif
+      if(segmentSize <= 0) segmentSize = length;
+      for(int offset = 0; offset < length; offset += segmentSize) {
+        int size = std::min(segmentSize, length - offset);
+        mux->handlePacket(socket, packet + offset, size, &sources[i], messages[i].msg_hdr.msg_namelen);
+      }
+    }
+  }
+#endif
+
+  int udpMuxReader(void* arg) {
+    UdpMuxSocket* socket = (UdpMuxSocket*)arg;
+    UdpMux* mux = socket->mux;
+#if PJWEBRTC_HAS_IO_URING
+    if(mux->configuration.ioUring && udpMuxUringReader(socket) == 0) return 0;
+#endif
+    bool batched = PJWEBRTC_UDPMUX_MMSG && mux->configuration.batchSize > 1;
+    int slotSize = PJMEDIA_MAX_MTU;
+#if PJWEBRTC_UDPMUX_MMSG
+    if(mux->configuration.gro) slotSize = GRO_SLOT_SIZE;
+#endif
+    std::vector<pj_uint8_t> buffers(batched ? mux->configuration.batchSize * slotSize : PJMEDIA_MAX_MTU);
+#if PJWEBRTC_UDPMUX_MMSG
+    int controlSize = mux->configuration.gro ? CMSG_SPACE(sizeof(int)) : 0;
+    std::vector<mmsghdr> messages(batched ? mux->configuration.batchSize : 0);
+    std::vector<iovec> vectors(messages.size());
+    std::vector<pj_sockaddr> sources(messages.size());
+    std::vector<char> controls(messages.size() * controlSize);
+#endif
+    while(mux->running) {
+      pj_fd_set_t readSet;
+      PJ_FD_ZERO(&readSet);
+      PJ_FD_SET(socket->sock, &readSet);
+      pj_time_val timeout = {0, 100};
+      if(pj_sock_select(socket->sock + 1, &readSet, nullptr, nullptr, &timeout) <= 0) continue;
+
+#if PJWEBRTC_UDPMUX_MMSG
+      if(batched) {
+        readBatch(socket, buffers.data(), slotSize, messages.data(), vectors.data(), sources.data(),
+                  controls.data(), controlSize);
+        continue;
+      }
+#endif
+      readOne(socket, buffers.data(), buffers.size());
+    }
+    return 0;
+  }
+
+  UdpMux::UdpMux() {
+    pool = nullptr;
+    running = false;
+    packetsReceived = 0;
+    packetsDropped = 0;
+    packetsSent = 0;
+    receiveCalls = 0;
+    sendCalls = 0;
+  }
+
+  void UdpMux::init(UdpMuxConfiguration& configurationp) {
+    configuration = configurationp;
+
+    pj_status_t status;
+    pool = pj_pool_create(&cachingPool.factory, "UdpMux.pool", 4096, 4096, NULL);
+
+    pj_str_t bindAddressString = pj_str((char*)configuration.bindAddress.c_str());
+    int af = configuration.bindAddress.find(':') == std::string::npos ? pj_AF_INET() : pj_AF_INET6();
+    pj_sockaddr bindAddress;
+    status = pj_sockaddr_init(af, &bindAddress, &bindAddressString, configuration.port);
+    assert(status == PJ_SUCCESS);
+
+    running = true;
+    for(int i = 0; i < configuration.socketsCount; i++) {
+      UdpMuxSocket* socket = PJ_POOL_ZALLOC_T(pool, UdpMuxSocket);
+      socket->mux = this;
+      socket->index = i;
+
+      status = pj_sock_socket(af, pj_SOCK_DGRAM(), 0, &socket->sock);
+      assert(status == PJ_SUCCESS);
+      int on = 1;
+      pj_sock_setsockopt(socket->sock, pj_SOL_SOCKET(), pj_SO_REUSEADDR(), &on, sizeof(on));
+#ifdef SO_REUSEPORT
+      pj_sock_setsockopt(socket->sock, pj_SOL_SOCKET(), SO_REUSEPORT, &on, sizeof(on));
+#endif
+#if PJWEBRTC_UDPMUX_MMSG && defined(UDP_GRO)
+      if(configuration.gro) setsockopt(socket->sock, SOL_UDP, UDP_GRO, &on, sizeof(on));
+#endif
+      status = pj_sock_bind(socket->sock, &bindAddress, pj_sockaddr_get_len(&bindAddress));
+      assert(status == PJ_SUCCESS);
+
+      if(i == 0 && configuration.port == 0) {
+        /* Ephemeral port, the other sockets have to join the same one */
+        int addressLength = sizeof(bindAddress);
+        pj_sock_getsockname(socket->sock, &bindAddress, &addressLength);
+        configuration.port = pj_sockaddr_get_port(&bindAddress);
+      }
+
+      status = pj_thread_create(pool, "udpmux", &udpMuxReader, (void*)socket,
+                                PJ_THREAD_DEFAULT_STACK_SIZE, 0, &socket->thread);
+      assert(status == PJ_SUCCESS);
+      sockets.push_back(socket);
+    }
+
+    std::string advertised = configuration.publicAddress.empty() ? configuration.bindAddress
+                                                                : configuration.publicAddress;
+    pj_str_t publicAddressString = pj_str((char*)advertised.c_str());
+    status = pj_sockaddr_init(af, &publicAddress, &publicAddressString, configuration.port);
+    assert(status == PJ_SUCCESS);
+    if(!pj_sockaddr_has_addr(&publicAddress)) {
+      /* Bound to any address, a wildcard is no use in a candidate */
+      status = pj_gethostip(af, &publicAddress);
+      assert(status == PJ_SUCCESS);
+      pj_sockaddr_set_port(&publicAddress, configuration.port);
+    }
+  }
+
+  void UdpMux::handlePacket(UdpMuxSocket* socket, pj_uint8_t* packet, pj_ssize_t size,
+                            const pj_sockaddr* source, int sourceLength) {
+    packetsReceived++;
+    bool stun = isStun(packet, size);
+    std::shared_ptr<MuxTransport> transport;
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(tablesMutex);
+      auto it = addressTable.find(AddressKey(source));
+      if(it != addressTable.end()) {
+        transport = it->second;
+      } else if(stun) {
+        /// First check from a new address, only the username tells which connection it is for
+        auto ufragIt = ufragTable.find(readStunUfrag(packet, size));
+        if(ufragIt != ufragTable.end()) transport = ufragIt->second;
+      }
+    }
+    if(!transport) {
+      packetsDropped++;
+      return;
+    }
+    transport->handlePacket(socket->index, packet, size, source, stun);
+  }
+
+  void UdpMux::registerTransport(const std::string& ufrag, std::shared_ptr<MuxTransport> transport) {
+    std::unique_lock<std::shared_timed_mutex> lock(tablesMutex);
+    ufragTable[ufrag] = transport;
+  }
+
+  void UdpMux::bindAddress(const pj_sockaddr* address, const pj_sockaddr* previous,
+                           std::shared_ptr<MuxTransport> transport) {
+    std::unique_lock<std::shared_timed_mutex> lock(tablesMutex);
+    if(previous) {
+      auto it = addressTable.find(AddressKey(previous));
+      /* Another connection may have latched it since, that entry stays */
+      if(it != addressTable.end() && it->second == transport) addressTable.erase(it);
+    }
+    addressTable[AddressKey(address)] = transport;
+  }
+
+  void UdpMux::unregisterTransport(MuxTransport* transport, const pj_sockaddr* boundAddress) {
+    /// Only the keys this transport registered, so closing a call does not scan the tables
+    std::shared_ptr<MuxTransport> last; // released after the lock, may destroy the transport
+    std::unique_lock<std::shared_timed_mutex> lock(tablesMutex);
+    auto ufragIt = ufragTable.find(transport->localUfrag);
+    if(ufragIt != ufragTable.end() && ufragIt->second.get() == transport) {
+      last = ufragIt->second;
+      ufragTable.erase(ufragIt);
+    }
+    if(boundAddress) {
+      auto it = addressTable.find(AddressKey(boundAddress));
+      if(it != addressTable.end() && it->second.get() == transport) {
+        last = it->second;
+        addressTable.erase(it);
+      }
+    }
+  }
+
+  pj_status_t UdpMux::send(int socketIndex, const pj_sockaddr* address, const void* data, pj_size_t size) {
+    pj_ssize_t sent = size;
+    sendCalls++;
+    packetsSent++;
+    return pj_sock_sendto(sockets[socketIndex]->sock, data, &sent, 0, address, pj_sockaddr_get_len(address));
+  }
+
+  pj_status_t UdpMux::sendBatch(int socketIndex, const pj_sockaddr* address, const std::vector<std::string>& packets) {
+#if PJWEBRTC_UDPMUX_MMSG
+    if(configuration.batchSize > 1 && packets.size() > 1) {
+      std::vector<mmsghdr> messages(packets.size());
+      std::vector<iovec> vectors(packets.size());
+      for(int i = 0; i < packets.size(); i++) {
+        vectors[i].iov_base = (void*)packets[i].data();
+        vectors[i].iov_len = packets[i].size();
+        pj_bzero(&messages[i], sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_name = (void*)address;
+        messages[i].msg_hdr.msg_namelen = pj_sockaddr_get_len(address);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+      }
+      int offset = 0;
+      while(offset < messages.size()) {
+        int count = sendmmsg(sockets[socketIndex]->sock, messages.data() + offset, messages.size() - offset, 0);
+        if(count <= 0) return pj_get_netos_error();
+        sendCalls++;
+        packetsSent += count;
+        offset += count;
+      }
+      return PJ_SUCCESS;
+    }
+#endif
+    pj_status_t status = PJ_SUCCESS;
+    for(auto& packet : packets) {
+      pj_status_t packetStatus = send(socketIndex, address, packet.data(), packet.size());
+      if(packetStatus != PJ_SUCCESS) status = packetStatus;
+    }
+    return status;
+  }
+
+  void UdpMux::stop() {
+    if(!running) return;
+    running = false;
+    for(auto socket : sockets) {
+      pj_thread_join(socket->thread);
+      pj_thread_destroy(socket->thread);
+      pj_sock_close(socket->sock);
+    }
+    sockets.clear();
+  }
+
+  UdpMux::~UdpMux() {
+    stop();
+    if(pool) pj_pool_release(pool);
+  }
+
+}
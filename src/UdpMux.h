@@ -0,0 +1,121 @@
+#ifndef PJWEBRTC_UDPMUX_H
+#define PJWEBRTC_UDPMUX_H
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "global.h"
+
+#if defined(__linux__)
+#define PJWEBRTC_UDPMUX_MMSG 1
+#else
+#define PJWEBRTC_UDPMUX_MMSG 0
+#endif
+
+/* Set by the PJWEBRTC_IO_URING cmake option, needs liburing 2.4 or newer */
+#ifndef PJWEBRTC_HAS_IO_URING
+#define PJWEBRTC_HAS_IO_URING 0
+#endif
+
+namespace webrtc {
+
+  class MuxTransport;
+  class UdpMux;
+
+  struct UdpMuxConfiguration {
+    std::string bindAddress = "0.0.0.0";
+    /// Address put in candidates, bindAddress when empty
+    std::string publicAddress;
+    /// 0 picks an ephemeral port, shared by every socket
+    int port = 0;
+    /// More than one socket needs SO_REUSEPORT, kernel spreads remote addresses between them
+    int socketsCount = 1;
+    /// Datagrams moved per recvmmsg/sendmmsg, 1 falls back to recvfrom/sendto
+    int batchSize = 32;
+    /// Let the kernel coalesce same-flow datagrams (UDP_GRO), every receive slot grows to 64KB
+    bool gro = false;
+    /// Multishot recvmsg into a kernel buffer ring, only when built with PJWEBRTC_HAS_IO_URING
+    bool ioUring = true;
+  };
+
+  struct UdpMuxSocket {
+    UdpMux* mux;
+    int index;
+    pj_sock_t sock;
+    pj_thread_t* thread;
+  };
+
+  /// Remote transport address packed for hashing
+  struct AddressKey {
+    pj_uint8_t bytes[18];
+    pj_uint8_t length;
+
+    AddressKey(const pj_sockaddr* address);
+    bool operator==(const AddressKey& other) const;
+  };
+
+  struct AddressKeyHash {
+    std::size_t operator()(const AddressKey& key) const;
+  };
+
+#if PJWEBRTC_HAS_IO_URING
+  /// Receive loop of one mux socket on io_uring, -1 when the kernel lacks multishot recvmsg or buffer rings,
+  /// or receiving fails for good, the caller then goes on with recvmmsg
+  int udpMuxUringReader(UdpMuxSocket* socket);
+#endif
+
+  /// Few UDP sockets on one port shared by all PeerConnections, packets are routed by STUN username and remote address.
+  class UdpMux {
+  private:
+    pj_pool_t* pool;
+    std::vector<UdpMuxSocket*> sockets;
+    std::atomic<bool> running;
+
+    std::shared_timed_mutex tablesMutex;
+    std::unordered_map<std::string, std::shared_ptr<MuxTransport>> ufragTable;
+    std::unordered_map<AddressKey, std::shared_ptr<MuxTransport>, AddressKeyHash> addressTable;
+
+    friend int udpMuxReader(void* arg);
+#if PJWEBRTC_HAS_IO_URING
+    friend int udpMuxUringReader(UdpMuxSocket* socket);
+#endif
+
+  public:
+    UdpMuxConfiguration configuration;
+    pj_sockaddr publicAddress;
+
+    std::atomic<unsigned long> packetsReceived;
+    std::atomic<unsigned long> packetsDropped;
+    std::atomic<unsigned long> packetsSent;
+    /// Packets per syscall is packetsReceived / receiveCalls and packetsSent / sendCalls
+    std::atomic<unsigned long> receiveCalls;
+    std::atomic<unsigned long> sendCalls;
+
+    UdpMux();
+    ~UdpMux();
+
+    void init(UdpMuxConfiguration& configurationp);
+    void stop();
+
+    /// Routes one received datagram, called from the reader threads
+    void handlePacket(UdpMuxSocket* socket, pj_uint8_t* packet, pj_ssize_t size,
+                      const pj_sockaddr* source, int sourceLength);
+
+    void registerTransport(const std::string& ufrag, std::shared_ptr<MuxTransport> transport);
+    /// Routes everything coming from address to transport, called once a connectivity check is authenticated.
+    /// previous, the address the transport latched before, stops routing to it. Called under the transport lock.
+    void bindAddress(const pj_sockaddr* address, const pj_sockaddr* previous, std::shared_ptr<MuxTransport> transport);
+    /// boundAddress is the one latched last, null when no check ever came
+    void unregisterTransport(MuxTransport* transport, const pj_sockaddr* boundAddress);
+
+    pj_status_t send(int socketIndex, const pj_sockaddr* address, const void* data, pj_size_t size);
+    /// Several datagrams to one address in a single syscall where sendmmsg exists
+    pj_status_t sendBatch(int socketIndex, const pj_sockaddr* address, const std::vector<std::string>& packets);
+  };
+
+}
+
+#endif //PJWEBRTC_UDPMUX_H
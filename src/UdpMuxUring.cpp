@@ -0,0 +1,104 @@
+#include "UdpMux.h"
+
+#if PJWEBRTC_HAS_IO_URING
+#include <liburing.h>
+#include <cerrno>
+#include <cstdio>
+
+namespace webrtc {
+
+  static const unsigned URING_ENTRIES = 64;
+  static const unsigned URING_BUFFER_GROUP = 0;
+  static const unsigned URING_BUFFERS_COUNT = 256; // power of two, buffer rings need it
+
+  struct UringReceiver {
+    io_uring ring;
+    io_uring_buf_ring* bufferRing;
+    std::vector<pj_uint8_t> buffers;
+    unsigned bufferSize;
+    msghdr header; /* Only name and control lengths are used, kernel fills the rest into the buffer */
+  };
+
+  static void armReceive(UdpMuxSocket* socket, UringReceiver& receiver) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&receiver.ring);
+    io_uring_prep_recvmsg_multishot(sqe, socket->sock, &receiver.header, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+  }
+
+  static void recycleBuffer(UringReceiver& receiver, unsigned bufferId) {
+    io_uring_buf_ring_add(receiver.bufferRing, receiver.buffers.data() + bufferId * receiver.bufferSize,
+                          receiver.bufferSize, bufferId, io_uring_buf_ring_mask(URING_BUFFERS_COUNT), 0);
+    io_uring_buf_ring_advance(receiver.bufferRing, 1);
+  }
+
+  int udpMuxUringReader(UdpMuxSocket* socket) {
+    UdpMux* mux = socket->mux;
+    UringReceiver receiver;
+    if(io_uring_queue_init(URING_ENTRIES, &receiver.ring, 0) < 0) return -1;
+    int ret;
+    receiver.bufferRing = io_uring_setup_buf_ring(&receiver.ring, URING_BUFFERS_COUNT, URING_BUFFER_GROUP, 0, &ret);
+    if(!receiver.bufferRing) {
+      io_uring_queue_exit(&receiver.ring);
+      return -1; // kernel older than 5.19, caller falls back to recvmmsg
+    }
+
+    /// Each provided buffer takes the recvmsg header, the source address and the datagram itself
+    receiver.bufferSize = sizeof(io_uring_recvmsg_out) + sizeof(pj_sockaddr) + PJMEDIA_MAX_MTU;
+    receiver.buffers.resize(receiver.bufferSize * URING_BUFFERS_COUNT);
+    for(unsigned i = 0; i < URING_BUFFERS_COUNT; i++) recycleBuffer(receiver, i);
+    pj_bzero(&receiver.header, sizeof(receiver.header));
+    receiver.header.msg_namelen = sizeof(pj_sockaddr);
+    armReceive(socket, receiver);
+
+    bool failed = false;
+    while(mux->running && !failed) {
+      io_uring_cqe* cqe;
+      __kernel_timespec timeout = {0, 100 * 1000000};
+      int waited = io_uring_submit_and_wait_timeout(&receiver.ring, &cqe, 1, &timeout, nullptr);
+      if(waited == -ETIME || waited == -EINTR) continue;
+      if(waited < 0) {
+        printf("UDP MUX IO_URING WAIT FAILED %d, FALLING BACK TO RECVMMSG\n", waited);
+        failed = true;
+        break;
+      }
+
+      unsigned head;
+      unsigned seen = 0;
+      bool rearm = false;
+      io_uring_for_each_cqe(&receiver.ring, head, cqe) {
+        seen++;
+        if(!(cqe->flags & IORING_CQE_F_MORE)) rearm = true; // multishot ended, out of buffers mostly
+        if(!(cqe->flags & IORING_CQE_F_BUFFER)) {
+          /// Anything but running out of buffers would fail again on every rearm, multishot recvmsg
+          /// unsupported gives -EINVAL here
+          if(cqe->res < 0 && cqe->res != -ENOBUFS) {
+            printf("UDP MUX IO_URING RECEIVE FAILED %d, FALLING BACK TO RECVMMSG\n", cqe->res);
+            failed = true;
+          }
+          continue;
+        }
+        unsigned bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        pj_uint8_t* buffer = receiver.buffers.data() + bufferId * receiver.bufferSize;
+        io_uring_recvmsg_out* out = cqe->res > 0
+            ? io_uring_recvmsg_validate(buffer, cqe->res, &receiver.header) : nullptr;
+        if(out && !(out->flags & MSG_TRUNC)) {
+          mux->handlePacket(socket, (pj_uint8_t*)io_uring_recvmsg_payload(out, &receiver.header),
+                            io_uring_recvmsg_payload_length(out, cqe->res, &receiver.header),
+                            (const pj_sockaddr*)io_uring_recvmsg_name(out), out->namelen);
+        }
+        recycleBuffer(receiver, bufferId);
+      }
+      io_uring_cq_advance(&receiver.ring, seen);
+      if(seen) mux->receiveCalls++;
+      if(rearm && !failed) armReceive(socket, receiver);
+    }
+
+    io_uring_free_buf_ring(&receiver.ring, receiver.bufferRing, URING_BUFFERS_COUNT, URING_BUFFER_GROUP);
+    io_uring_queue_exit(&receiver.ring);
+    return failed ? -1 : 0;
+  }
+
+}
+
+#endif